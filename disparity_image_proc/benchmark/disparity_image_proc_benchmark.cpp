@@ -0,0 +1,285 @@
+#include <disparity_image_proc/benchmark_helpers.h>
+#include <disparity_image_proc/disparity_image_processor.h>
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// Benchmarks of disparity_image_proc kernels on synthetic disparity images.
+// Neither GPU nor ROS master is needed.
+//
+// Arguments of each benchmark are (width, height, percentage of invalid pixels).
+
+namespace
+{
+
+using namespace disparity_image_proc::benchmark_helpers;
+
+const float MAX_DISPARITY = 127.0f;
+const int FRACTIONAL_BITS = 4;
+
+cv::Mat toFixedPoint(const stereo_msgs::DisparityImage& disparity)
+{
+  cv::Mat fixed_point(disparity.image.height, disparity.image.width, CV_16SC1);
+  const float* data = reinterpret_cast<const float*>(disparity.image.data.data());
+  for (int i = 0; i < fixed_point.rows * fixed_point.cols; i++)
+    fixed_point.at<int16_t>(i / fixed_point.cols, i % fixed_point.cols) = static_cast<int16_t>(data[i] * (1 << FRACTIONAL_BITS));
+  return fixed_point;
+}
+
+/**
+ * \brief Input and timer shared by benchmarks
+ */
+class Fixture
+{
+public:
+  explicit Fixture(const benchmark::State& state)
+    : width_(state.range(0)), height_(state.range(1)),
+      disparity_(makeDisparity(width_, height_, MAX_DISPARITY, 1.0f / (1 << FRACTIONAL_BITS), state.range(2))),
+      camera_info_(new sensor_msgs::CameraInfo(makeCameraInfo(width_, height_))),
+      elapsed_ns_(0.0)
+  {
+  }
+
+  std::shared_ptr<DisparityImageProcessor> makeProcessor()
+  {
+    return std::make_shared<DisparityImageProcessor>(disparity_, camera_info_);
+  }
+
+  std::shared_ptr<DisparityImageProcessor> makeFixedPointProcessor()
+  {
+    return std::make_shared<DisparityImageProcessor>(disparity_, toFixedPoint(*disparity_), FRACTIONAL_BITS, camera_info_);
+  }
+
+  template <typename Function> void run(benchmark::State& state, Function function)
+  {
+    for (auto _ : state)
+    {
+      auto start = std::chrono::steady_clock::now();
+      function();
+      elapsed_ns_ += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double pixels = static_cast<double>(width_) * height_;
+    state.SetItemsProcessed(state.iterations() * pixels);
+    state.counters["ns_per_pixel"] = elapsed_ns_ / (state.iterations() * pixels);
+  }
+
+  int width_;
+  int height_;
+  stereo_msgs::DisparityImagePtr disparity_;
+  sensor_msgs::CameraInfoPtr camera_info_;
+
+private:
+  double elapsed_ns_;
+};
+
+void resolutions(benchmark::internal::Benchmark* benchmark)
+{
+  applyResolutions(benchmark, {0, 30, 50});
+  benchmark->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+static void BM_GetPoint3D(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  fixture.run(state, [&]
+  {
+    pcl::PointXYZ point;
+    for (int v = 0; v < fixture.height_; v++)
+    {
+      for (int u = 0; u < fixture.width_; u++)
+      {
+        bool valid = processor->getPoint3D(u, v, point);
+        benchmark::DoNotOptimize(valid);
+        benchmark::DoNotOptimize(point);
+      }
+    }
+  });
+}
+BENCHMARK(BM_GetPoint3D)->Apply(resolutions);
+
+static void BM_GetPoint3DWithDepthTable(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  processor->setDisparityStep(fixture.disparity_->delta_d);
+  fixture.run(state, [&]
+  {
+    pcl::PointXYZ point;
+    for (int v = 0; v < fixture.height_; v++)
+    {
+      for (int u = 0; u < fixture.width_; u++)
+      {
+        bool valid = processor->getPoint3D(u, v, point);
+        benchmark::DoNotOptimize(valid);
+        benchmark::DoNotOptimize(point);
+      }
+    }
+  });
+}
+BENCHMARK(BM_GetPoint3DWithDepthTable)->Apply(resolutions);
+
+static void BM_GetPoint3DWithoutDepthTable(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  processor->setDisparityStep(0.0f);
+  fixture.run(state, [&]
+  {
+    pcl::PointXYZ point;
+    for (int v = 0; v < fixture.height_; v++)
+    {
+      for (int u = 0; u < fixture.width_; u++)
+      {
+        bool valid = processor->getPoint3D(u, v, point);
+        benchmark::DoNotOptimize(valid);
+        benchmark::DoNotOptimize(point);
+      }
+    }
+  });
+}
+BENCHMARK(BM_GetPoint3DWithoutDepthTable)->Apply(resolutions);
+
+static void BM_ToPointCloud(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  pcl::PointCloud<pcl::PointXYZ> pointcloud;
+  fixture.run(state, [&]
+  {
+    processor->toPointCloud(pointcloud);
+    benchmark::ClobberMemory();
+  });
+}
+BENCHMARK(BM_ToPointCloud)->Apply(resolutions);
+
+static void BM_ToDepthImage(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  cv::Mat depth_image;
+  fixture.run(state, [&]
+  {
+    processor->toDepthImage(depth_image);
+    benchmark::ClobberMemory();
+  });
+}
+BENCHMARK(BM_ToDepthImage)->Apply(resolutions);
+
+static void BM_ToPointCloudAndDepthImage(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  pcl::PointCloud<pcl::PointXYZ> pointcloud;
+  cv::Mat depth_image;
+  fixture.run(state, [&]
+  {
+    processor->toPointCloudAndDepthImage(pointcloud, depth_image);
+    benchmark::ClobberMemory();
+  });
+}
+BENCHMARK(BM_ToPointCloudAndDepthImage)->Apply(resolutions);
+
+// BM_ToPointCloud uses depth table only if it's the default of this build, and these compare both modes
+static void BM_ToPointCloudWithDepthTable(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  processor->setDisparityStep(fixture.disparity_->delta_d);
+  pcl::PointCloud<pcl::PointXYZ> pointcloud;
+  fixture.run(state, [&]
+  {
+    processor->toPointCloud(pointcloud);
+    benchmark::ClobberMemory();
+  });
+}
+BENCHMARK(BM_ToPointCloudWithDepthTable)->Apply(resolutions);
+
+static void BM_ToPointCloudWithoutDepthTable(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  processor->setDisparityStep(0.0f);
+  pcl::PointCloud<pcl::PointXYZ> pointcloud;
+  fixture.run(state, [&]
+  {
+    processor->toPointCloud(pointcloud);
+    benchmark::ClobberMemory();
+  });
+}
+BENCHMARK(BM_ToPointCloudWithoutDepthTable)->Apply(resolutions);
+
+static void BM_ToPointCloudFixedPoint(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeFixedPointProcessor();
+  pcl::PointCloud<pcl::PointXYZ> pointcloud;
+  fixture.run(state, [&]
+  {
+    processor->toPointCloud(pointcloud);
+    benchmark::ClobberMemory();
+  });
+}
+BENCHMARK(BM_ToPointCloudFixedPoint)->Apply(resolutions);
+
+static void BM_ToPointCloudParallel(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  disparity_image_proc::ThreadPool thread_pool(4);
+  pcl::PointCloud<pcl::PointXYZ> pointcloud;
+  fixture.run(state, [&]
+  {
+    processor->toPointCloud(pointcloud, thread_pool);
+    benchmark::ClobberMemory();
+  });
+}
+BENCHMARK(BM_ToPointCloudParallel)->Apply(resolutions)->UseRealTime();
+
+static void BM_ToPointCloudDecimated(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+  pcl::PointCloud<pcl::PointXYZ> pointcloud;
+  fixture.run(state, [&]
+  {
+    processor->toPointCloud(pointcloud, 4, DisparityImageProcessor::DecimationMethod::MEDIAN);
+    benchmark::ClobberMemory();
+  });
+}
+BENCHMARK(BM_ToPointCloudDecimated)->Apply(resolutions);
+
+static void BM_ToIndexedPointCloudByMask(benchmark::State& state)
+{
+  Fixture fixture(state);
+  auto processor = fixture.makeProcessor();
+
+  // A quarter of image in the center, like a region of moving object
+  cv::Mat mask(fixture.height_, fixture.width_, CV_8UC1);
+  for (int v = 0; v < fixture.height_; v++)
+  {
+    for (int u = 0; u < fixture.width_; u++)
+    {
+      bool inside = std::abs(u - fixture.width_ / 2) < fixture.width_ / 4 && std::abs(v - fixture.height_ / 2) < fixture.height_ / 4;
+      mask.at<unsigned char>(v, u) = inside ? 255 : 0;
+    }
+  }
+
+  pcl::PointCloud<pcl::PointXYZ> pointcloud;
+  std::vector<int> indices;
+  fixture.run(state, [&]
+  {
+    processor->toIndexedPointCloud(mask, pointcloud, indices);
+    benchmark::ClobberMemory();
+  });
+}
+BENCHMARK(BM_ToIndexedPointCloudByMask)->Apply(resolutions);
+
+BENCHMARK_MAIN();
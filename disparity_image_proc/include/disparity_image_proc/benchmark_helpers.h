@@ -0,0 +1,153 @@
+#ifndef DISPARITY_IMAGE_PROC_BENCHMARK_HELPERS_H
+#define DISPARITY_IMAGE_PROC_BENCHMARK_HELPERS_H
+
+#include <image_geometry/pinhole_camera_model.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <stereo_msgs/DisparityImage.h>
+
+#include <cmath>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+// Synthetic camera, disparity and points shared by benchmarks of disparity_image_proc and scene_flow_constructor,
+// so all of them run at the same resolutions with the same intrinsics.
+// Header only, and google benchmark isn't included here.
+
+namespace disparity_image_proc
+{
+namespace benchmark_helpers
+{
+
+const double FOCAL_LENGTH = 700.0;
+const double BASELINE = 0.12;
+
+/**
+ * \brief Apply (width, height, argument) of each resolution to a google benchmark
+ *
+ * \param benchmark benchmark::internal::Benchmark
+ * \param arguments Third argument of each benchmark, such as percentage of invalid pixels
+ */
+template <typename BenchmarkT> void applyResolutions(BenchmarkT* benchmark, std::initializer_list<int> arguments)
+{
+  const int sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+  for (const auto& size : sizes)
+  {
+    for (int argument : arguments)
+      benchmark->Args({size[0], size[1], argument});
+  }
+}
+
+/**
+ * \brief Rectified camera with principal point at the center of the image
+ *
+ * \param tx Tx of projection matrix, -FOCAL_LENGTH * BASELINE for right camera
+ */
+inline sensor_msgs::CameraInfo makeCameraInfo(int width, int height, double tx = 0.0)
+{
+  sensor_msgs::CameraInfo camera_info;
+  camera_info.header.frame_id = "camera";
+  camera_info.width = width;
+  camera_info.height = height;
+  camera_info.K = {FOCAL_LENGTH, 0.0, width / 2.0, 0.0, FOCAL_LENGTH, height / 2.0, 0.0, 0.0, 1.0};
+  camera_info.R = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  camera_info.P = {FOCAL_LENGTH, 0.0, width / 2.0, tx, 0.0, FOCAL_LENGTH, height / 2.0, 0.0, 0.0, 0.0, 1.0, 0.0};
+  return camera_info;
+}
+
+inline image_geometry::PinholeCameraModel makeCameraModel(int width, int height)
+{
+  image_geometry::PinholeCameraModel camera_model;
+  camera_model.fromCameraInfo(makeCameraInfo(width, height));
+  return camera_model;
+}
+
+/**
+ * \brief Ground truth disparity of a slanted plane, increasing from top to bottom like a ground plane
+ *
+ * Disparity is from 4 to max_disparity - 4, so noise of 2 pixels keeps it in the range.
+ */
+inline float groundTruthDisparity(int u, int v, int height, float max_disparity)
+{
+  return 6.0f + (max_disparity - 12.0f) * v / height + 2.0f * std::sin(u * 0.01f);
+}
+
+/**
+ * \brief Disparity message of groundTruthDisparity() with noise, quantized like SGM
+ *
+ * \param disparity_step Quantization step, such as 1/16
+ * \param invalid_percentage Percentage of pixels whose disparity is -1 as invalid
+ */
+inline stereo_msgs::DisparityImagePtr makeDisparity(int width, int height, float max_disparity, float disparity_step, int invalid_percentage)
+{
+  stereo_msgs::DisparityImagePtr disparity(new stereo_msgs::DisparityImage());
+  disparity->f = FOCAL_LENGTH;
+  disparity->T = BASELINE;
+  disparity->min_disparity = 0.0f;
+  disparity->max_disparity = max_disparity;
+  disparity->delta_d = disparity_step;
+  disparity->image.width = width;
+  disparity->image.height = height;
+  disparity->image.encoding = "32FC1";
+  disparity->image.step = width * sizeof(float);
+  disparity->image.data.resize(disparity->image.step * height);
+
+  std::mt19937 random_engine(0);
+  std::uniform_real_distribution<float> noise(-2.0f, 2.0f);
+  std::uniform_int_distribution<int> percentage(0, 99);
+
+  float* data = reinterpret_cast<float*>(disparity->image.data.data());
+  for (int v = 0; v < height; v++)
+  {
+    for (int u = 0; u < width; u++)
+    {
+      float value = groundTruthDisparity(u, v, height, max_disparity) + noise(random_engine);
+      value = std::round(value / disparity_step) * disparity_step;
+      if (percentage(random_engine) < invalid_percentage)
+        value = -1.0f;
+      data[v * width + u] = value;
+    }
+  }
+  return disparity;
+}
+
+/**
+ * \brief Organized pointcloud in (x, y, z, 1) layout, slightly moved from the pixel like transformed previous points
+ *
+ * \param invalid_percentage Percentage of NaN points
+ */
+inline std::vector<float> makePoints(const image_geometry::PinholeCameraModel& camera_model, int width, int height, int invalid_percentage)
+{
+  std::mt19937 random_engine(0);
+  std::uniform_real_distribution<float> depth(0.5f, 40.0f);
+  std::uniform_real_distribution<float> motion(-0.1f, 0.1f);
+  std::uniform_int_distribution<int> percentage(0, 99);
+
+  std::vector<float> points(4 * width * height);
+  for (int v = 0; v < height; v++)
+  {
+    for (int u = 0; u < width; u++)
+    {
+      float* point = &points[4 * (v * width + u)];
+      if (percentage(random_engine) < invalid_percentage)
+      {
+        point[0] = point[1] = point[2] = std::nanf("");
+        point[3] = 1.0f;
+        continue;
+      }
+
+      cv::Point3d ray = camera_model.projectPixelTo3dRay(cv::Point2d(u, v));
+      float z = depth(random_engine);
+      point[0] = ray.x * z + motion(random_engine);
+      point[1] = ray.y * z + motion(random_engine);
+      point[2] = z + motion(random_engine);
+      point[3] = 1.0f;
+    }
+  }
+  return points;
+}
+
+} // namespace benchmark_helpers
+} // namespace disparity_image_proc
+
+#endif // DISPARITY_IMAGE_PROC_BENCHMARK_HELPERS_H
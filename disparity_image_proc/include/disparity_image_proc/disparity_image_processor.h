@@ -1,6 +1,9 @@
 #ifndef DISPARITY_IMAGE_PROCESSOR_H
 #define DISPARITY_IMAGE_PROCESSOR_H
 
+#include <disparity_image_proc/ray_lookup_table.h>
+#include <disparity_image_proc/reprojection_kernel.h>
+#include <disparity_image_proc/thread_pool.h>
 #include <image_geometry/pinhole_camera_model.h>
 #include <sensor_msgs/CameraInfo.h>
 #include <stereo_msgs/DisparityImage.h>
@@ -9,26 +12,258 @@
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 
+#include <cstdint>
 #include <exception>
+#include <memory>
+#include <vector>
 #include <opencv2/core/core.hpp>
 
 class DisparityImageProcessor
 {
 public:
+  /**
+   * \brief How a block of disparity is reduced to one pixel by decimation
+   */
+  enum class DecimationMethod
+  {
+    /**
+     * \brief Use disparity at top-left pixel of each block
+     */
+    SAMPLE,
+    /**
+     * \brief Use median of valid disparities in each block, placed at center of the block
+     */
+    MEDIAN
+  };
+
   image_geometry::PinholeCameraModel _left_camera_model; 
-  stereo_msgs::DisparityImage _disparity_msg;
+  /**
+   * \brief View to image data of getDisparityMessage() (CV_32FC1), or fixed-point disparity (CV_16SC1)
+   */
   cv::Mat _disparity_map;
+  /**
+   * \brief Ray direction of each pixel, shared between processors of same camera
+   */
+  std::shared_ptr<const RayLookupTable> _ray_table;
 
+  /**
+   * \brief Construct without copying disparity image
+   *
+   * Disparity image of the message is referred directly,
+   * so the message must not be modified while this processor is alive.
+   */
   DisparityImageProcessor(const stereo_msgs::DisparityImageConstPtr& disparity_msg, const sensor_msgs::CameraInfoConstPtr& left_camera_info);
+  /**
+   * \brief Construct with a copy of disparity message
+   */
   DisparityImageProcessor(const stereo_msgs::DisparityImage& disparity_msg, const sensor_msgs::CameraInfo& left_camera_info);
+  /**
+   * \brief Construct from fixed-point disparity without conversion to float
+   *
+   * \param disparity_info Header, focal length, baseline and disparity range. Image of the message isn't used.
+   * \param fixed_point_disparity CV_16SC1 disparity multiplied by 2^fractional_bits, such as output of cv::StereoSGBM. Shared without copy.
+   * \param fractional_bits Number of fractional bits of fixed_point_disparity, from 0 to 8.
+   *        std::invalid_argument is thrown otherwise, like for other types than CV_16SC1.
+   */
+  DisparityImageProcessor(const stereo_msgs::DisparityImageConstPtr& disparity_info, const cv::Mat& fixed_point_disparity, int fractional_bits, const sensor_msgs::CameraInfoConstPtr& left_camera_info);
+  /**
+   * \brief Return memory of the validity mask to the pool, to be reused by processors of next frames
+   */
+  ~DisparityImageProcessor();
   
   bool getDisparity(int u, int v, float& disparity);
   bool getPoint3D(int u, int v, pcl::PointXYZ& point3d);
   bool getPoint3D(int u, int v, tf2::Vector3& point3d);
   int getWidth();
   int getHeight();
+  /**
+   * \brief Whether disparity at the pixel is valid
+   *
+   * Looks up the validity mask computed at construction, by the same condition as getPoint3D().
+   * Pixels out of image are invalid.
+   */
+  inline bool isValidPixel(int u, int v)
+  {
+    if (u < 0 || u >= _disparity_map.cols || v < 0 || v >= _disparity_map.rows)
+      return false;
+    return (_validity_mask[v * _validity_mask_stride + u / 64] >> (u % 64)) & 1;
+  }
+  /**
+   * \brief Packed validity of row v
+   *
+   * Bit (u % 64) of word (u / 64) is set at valid pixel. Bits after the end of the row are cleared.
+   */
+  const uint64_t* getValidityMaskRow(int v);
+  /**
+   * \brief Number of 64-bit words of each row of the validity mask
+   */
+  int getValidityMaskStride();
+  /**
+   * \brief Call function(u, v) for each valid pixel in row-major order
+   *
+   * 64 invalid pixels are skipped at once, so this is faster than checking each pixel in sparse disparity image.
+   */
+  template <typename Function> void forEachValidPixel(Function function)
+  {
+    for (int v = 0; v < _disparity_map.rows; v++)
+    {
+      const uint64_t* mask_row = getValidityMaskRow(v);
+      for (int word = 0; word < _validity_mask_stride; word++)
+      {
+        for (uint64_t bits = mask_row[word]; bits != 0; bits &= bits - 1)
+          function(word * 64 + __builtin_ctzll(bits), v);
+      }
+    }
+  }
+  /**
+   * \brief Get focal length, baseline, valid disparity range and depth table for reprojectRow()
+   */
+  disparity_image_proc::ReprojectionParams getReprojectionParams();
+  /**
+   * \brief Quantization step of disparity used by the depth table, or 0 if the table isn't used
+   */
+  float getDisparityStep();
+  /**
+   * \brief Set quantization step of disparity to convert disparity to depth by lookup table
+   *
+   * Float disparity uses delta_d of disparity message by default only if disparity_image_proc::isDepthTableFasterThanDivision(),
+   * and is divided otherwise. Set delta_d to enable the lookup table, or 0 to disable it.
+   * Fixed-point disparity always uses the table.
+   */
+  void setDisparityStep(float disparity_step);
   void toPointCloud(pcl::PointCloud<pcl::PointXYZ> &pointcloud);
   void toDepthImage(cv::Mat& depth_image);
+  /**
+   * \brief Construct organized pointcloud and depth image in one traversal of disparity image
+   *
+   * \param pointcloud Output organized pointcloud, same as toPointCloud()
+   * \param depth_image Output depth image, same as toDepthImage()
+   * \param valid_mask Output CV_8UC1 mask which is 255 at valid pixels. Skipped if nullptr.
+   */
+  void toPointCloudAndDepthImage(pcl::PointCloud<pcl::PointXYZ> &pointcloud, cv::Mat& depth_image, cv::Mat* valid_mask = nullptr);
+  /**
+   * \brief Parallel version of toPointCloud(), which processes bands of rows on the thread pool
+   *
+   * Output is identical to toPointCloud().
+   */
+  void toPointCloud(pcl::PointCloud<pcl::PointXYZ> &pointcloud, disparity_image_proc::ThreadPool& thread_pool);
+  /**
+   * \brief Parallel version of toPointCloudAndDepthImage(), which processes bands of rows on the thread pool
+   */
+  void toPointCloudAndDepthImage(pcl::PointCloud<pcl::PointXYZ> &pointcloud, cv::Mat& depth_image, disparity_image_proc::ThreadPool& thread_pool, cv::Mat* valid_mask = nullptr);
+
+  /**
+   * \brief Construct organized pointcloud only from pixels selected by mask
+   *
+   * \param mask CV_8UC1 image of same size as disparity image. Pixels with non-zero value are reprojected.
+   * \param pointcloud Output organized pointcloud. Points of unselected pixels are NaN.
+   */
+  void toPointCloud(const cv::Mat& mask, pcl::PointCloud<pcl::PointXYZ> &pointcloud);
+  /**
+   * \brief Construct organized pointcloud only from pixels inside regions of interest
+   *
+   * \param rois Regions of interest. Regions out of image are clipped.
+   * \param pointcloud Output organized pointcloud. Points outside of the regions are NaN.
+   */
+  void toPointCloud(const std::vector<cv::Rect>& rois, pcl::PointCloud<pcl::PointXYZ> &pointcloud);
+  /**
+   * \brief Construct compact pointcloud of valid points selected by mask
+   *
+   * \param mask CV_8UC1 image of same size as disparity image. Pixels with non-zero value are reprojected.
+   * \param pointcloud Output unorganized pointcloud which contains only valid points
+   * \param indices Output pixel index (v * width + u) of each point
+   */
+  void toIndexedPointCloud(const cv::Mat& mask, pcl::PointCloud<pcl::PointXYZ> &pointcloud, std::vector<int>& indices);
+  /**
+   * \brief Construct compact pointcloud of valid points inside regions of interest
+   *
+   * Pixels covered by several regions appear once per region.
+   */
+  void toIndexedPointCloud(const std::vector<cv::Rect>& rois, pcl::PointCloud<pcl::PointXYZ> &pointcloud, std::vector<int>& indices);
+  /**
+   * \brief Construct compact pointcloud of valid points at given pixels
+   *
+   * \param pixel_indices Pixel index (v * width + u) to reproject. Sorted indices are processed faster.
+   */
+  void toIndexedPointCloud(const std::vector<int>& pixel_indices, pcl::PointCloud<pcl::PointXYZ> &pointcloud, std::vector<int>& indices);
+
+  /**
+   * \brief Construct organized pointcloud smaller than disparity image
+   *
+   * Each point corresponds to a block of decimation x decimation pixels.
+   * Use getDecimatedCameraInfo() to project the points to the smaller image plane.
+   *
+   * \param pointcloud Output organized pointcloud of (width / decimation) x (height / decimation)
+   * \param decimation Size of block, such as 2 or 4
+   * \param method How disparity of each block is chosen
+   */
+  void toPointCloud(pcl::PointCloud<pcl::PointXYZ> &pointcloud, int decimation, DecimationMethod method = DecimationMethod::SAMPLE);
+  /**
+   * \brief Camera info whose intrinsics are adjusted to pointcloud made by toPointCloud() with decimation
+   */
+  void getDecimatedCameraInfo(int decimation, DecimationMethod method, sensor_msgs::CameraInfo& camera_info);
+  /**
+   * \brief Source disparity message, such as for its header
+   *
+   * Image of the message isn't disparity of this processor if it's constructed from fixed-point disparity.
+   */
+  const stereo_msgs::DisparityImage& getDisparityMessage() const
+  {
+    return *_disparity_msg;
+  }
+
+private:
+  /**
+   * \brief Source message of _disparity_map, shared with the caller without copy
+   */
+  stereo_msgs::DisparityImageConstPtr _disparity_msg;
+  float _disparity_step;
+  float _disparity_step_inverse;
+  /**
+   * \brief Depth of each quantized disparity, shared between processors of same parameters. nullptr if not built.
+   */
+  std::shared_ptr<const std::vector<float>> _depth_table;
+  /**
+   * \brief Packed validity of each pixel, _validity_mask_stride words per row
+   *
+   * Memory is taken from a pool of destroyed processors, so a new processor of each frame doesn't allocate.
+   */
+  std::vector<uint64_t> _validity_mask;
+  int _validity_mask_stride;
+
+  void initialize(const sensor_msgs::CameraInfo& left_camera_info, float disparity_step);
+  /**
+   * \brief Depth at valid pixel, converted by depth table in the same way as reprojectRow()
+   */
+  float getDepth(int u, int v);
+  void updateValidityMask();
+  /**
+   * \brief Reproject pixels [u_begin, u_end) in row v of float or fixed-point disparity image
+   *
+   * Output pointers point the element of u_begin.
+   */
+  void reprojectImageRow(int v, int u_begin, int u_end, float* points, float* depth, unsigned char* valid);
+  /**
+   * \brief Reproject pixels [u_begin, u_end) in row v and append valid points to compact pointcloud
+   *
+   * Points are reprojected into the end of the pointcloud and compacted in place,
+   * so no buffer is shared between calls on different pointclouds.
+   */
+  void appendValidPoints(int v, int u_begin, int u_end, pcl::PointCloud<pcl::PointXYZ> &pointcloud, std::vector<int>& indices);
+  /**
+   * \brief Clip regions of interest by image boundary
+   */
+  std::vector<cv::Rect> clipRegions(const std::vector<cv::Rect>& rois);
+  void fillInvalidPoints(float* points, int count);
+  /**
+   * \brief Reduce blocks in block row v_block to one row of disparity
+   *
+   * \param output Disparity of each block. Invalid blocks are NaN for float and -1 for fixed-point disparity.
+   */
+  template <typename DisparityT> void decimateRow(int v_block, int decimation, DecimationMethod method, std::vector<DisparityT>& output);
+  bool isValidDisparity(float disparity);
+  bool isValidDisparity(int16_t fixed_point_disparity);
+  void resizeOrganizedPointCloud(pcl::PointCloud<pcl::PointXYZ> &pointcloud, int width, int height);
 };
 
 
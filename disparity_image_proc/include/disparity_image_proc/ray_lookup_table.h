@@ -0,0 +1,71 @@
+#ifndef RAY_LOOKUP_TABLE_H
+#define RAY_LOOKUP_TABLE_H
+
+#include <image_geometry/pinhole_camera_model.h>
+#include <sensor_msgs/CameraInfo.h>
+
+#include <memory>
+#include <vector>
+
+/**
+ * \brief Direction (x/z, y/z) of the ray through each pixel of a rectified image
+ *
+ * Rays of a rectified pinhole camera are separable,
+ * so x/z only depends on u and y/z only depends on v.
+ * The table holds one value per column and one per row instead of one per pixel.
+ */
+class RayLookupTable
+{
+public:
+  /**
+   * \brief Number of cameras whose tables are cached by get()
+   */
+  static constexpr size_t MAX_CACHED_TABLES = 8;
+
+  RayLookupTable(const image_geometry::PinholeCameraModel& camera_model, int width, int height);
+
+  /**
+   * \brief Get a table for the camera, shared by all processors using the same CameraInfo
+   *
+   * Tables of up to MAX_CACHED_TABLES cameras are cached at once,
+   * so a table is only rebuilt when the camera parameters or the image size are changed.
+   */
+  static std::shared_ptr<const RayLookupTable> get(const image_geometry::PinholeCameraModel& camera_model, int width, int height);
+
+  /**
+   * \brief x/z of the ray through column u
+   */
+  inline float rayX(int u) const
+  {
+    return _ray_x[u];
+  }
+  /**
+   * \brief y/z of the ray through row v
+   */
+  inline float rayY(int v) const
+  {
+    return _ray_y[v];
+  }
+  /**
+   * \brief Pointer to x/z of all columns, for processing a whole row
+   */
+  inline const float* rayXData() const
+  {
+    return _ray_x.data();
+  }
+
+  int getWidth() const;
+  int getHeight() const;
+
+  /**
+   * \brief Return true if the table was built from equivalent camera parameters and image size
+   */
+  bool isCompatible(const sensor_msgs::CameraInfo& camera_info, int width, int height) const;
+
+private:
+  sensor_msgs::CameraInfo _camera_info;
+  std::vector<float> _ray_x;
+  std::vector<float> _ray_y;
+};
+
+#endif // RAY_LOOKUP_TABLE_H
@@ -0,0 +1,101 @@
+#ifndef REPROJECTION_KERNEL_H
+#define REPROJECTION_KERNEL_H
+
+#include <cstdint>
+#include <vector>
+
+namespace disparity_image_proc
+{
+
+/**
+ * \brief Parameters shared by all rows of a disparity image
+ */
+struct ReprojectionParams
+{
+  /**
+   * \brief Focal length multiplied by baseline
+   */
+  float focal_baseline;
+  float min_disparity;
+  float max_disparity;
+
+  /**
+   * \brief Depth of each quantized disparity, indexed by disparity / disparity step
+   *
+   * NaN at invalid disparity. nullptr if quantization of disparity is unknown.
+   */
+  const float* depth_table;
+  int depth_table_size;
+  /**
+   * \brief Inverse of disparity step, used to convert float disparity to index of depth_table
+   */
+  float disparity_step_inverse;
+};
+
+/**
+ * \brief Build depth_table of ReprojectionParams
+ *
+ * \param params Focal length, baseline and disparity range
+ * \param disparity_step Quantization step of disparity, such as 1/16
+ * \param depth_table Output table, covering disparity from 0 to max_disparity (or at most 2^16 steps)
+ */
+void buildDepthTable(const ReprojectionParams& params, float disparity_step, std::vector<float>& depth_table);
+
+/**
+ * \brief Whether reprojectRow() of this build converts quantized float disparity faster by depth_table than by division
+ *
+ * True only when the kernel is built with AVX2, which gathers the table.
+ * With SSE2 and scalar code, the table was measured slower or no faster than division.
+ */
+bool isDepthTableFasterThanDivision();
+
+/**
+ * \brief Reproject a row of disparity image to 3D points and depth
+ *
+ * Disparity out of [min_disparity, max_disparity], zero or NaN is treated as invalid
+ * and NaN is written at the pixel.
+ * If depth_table is given, disparity on a quantization step is converted by looking up the table
+ * (gathered with AVX2, loaded per pixel with SSE2 and scalar code), and only other valid disparity is divided.
+ * Without the table, depth is divided with AVX or SSE2 if the compiler enables them, and scalar code otherwise.
+ *
+ * \param disparity Disparity of each pixel in the row
+ * \param width Number of pixels in the row
+ * \param ray_x x/z of the ray through each pixel
+ * \param ray_y y/z of the ray through the row
+ * \param params Camera and disparity range parameters
+ * \param points Output (x, y, z, 1.0) of each pixel, same memory layout as pcl::PointXYZ. Skipped if nullptr.
+ * \param depth Output depth of each pixel. Skipped if nullptr.
+ * \param valid Output 255 for valid and 0 for invalid pixel. Skipped if nullptr.
+ */
+void reprojectRow(const float* disparity, int width, const float* ray_x, float ray_y, const ReprojectionParams& params, float* points, float* depth, unsigned char* valid = nullptr);
+
+/**
+ * \brief Reproject a row of fixed-point disparity image by looking up depth_table
+ *
+ * Disparity isn't converted to float, so depth_table of params must be built.
+ * Parameters other than disparity are same as reprojectRow().
+ *
+ * \param disparity Disparity multiplied by inverse of disparity step, such as output of cv::StereoSGBM
+ */
+void reprojectFixedPointRow(const int16_t* disparity, int width, const float* ray_x, float ray_y, const ReprojectionParams& params, float* points, float* depth, unsigned char* valid = nullptr);
+
+/**
+ * \brief Pack validity of a row of disparity image into bits
+ *
+ * Bit (u % 64) of mask[u / 64] is set if disparity at u is valid by the same condition as reprojectRow().
+ * Bits after the end of the row are cleared.
+ *
+ * \param mask Output of (width + 63) / 64 words
+ */
+void validityMaskRow(const float* disparity, int width, const ReprojectionParams& params, uint64_t* mask);
+
+/**
+ * \brief Pack validity of a row of fixed-point disparity image into bits
+ *
+ * Same as validityMaskRow() with the condition of reprojectFixedPointRow().
+ */
+void validityMaskFixedPointRow(const int16_t* disparity, int width, const ReprojectionParams& params, uint64_t* mask);
+
+} // namespace disparity_image_proc
+
+#endif // REPROJECTION_KERNEL_H
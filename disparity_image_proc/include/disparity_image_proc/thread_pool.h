@@ -0,0 +1,65 @@
+#ifndef DISPARITY_IMAGE_PROC_THREAD_POOL_H
+#define DISPARITY_IMAGE_PROC_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace disparity_image_proc
+{
+
+/**
+ * \brief Persistent worker threads to process bands of rows in parallel
+ *
+ * Threads are created once by the constructor and reused by every parallelFor() call.
+ */
+class ThreadPool
+{
+public:
+  /**
+   * \param number_of_threads Number of threads including the thread calling parallelFor()
+   */
+  explicit ThreadPool(int number_of_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int getNumberOfThreads() const;
+
+  /**
+   * \brief Split [0, count) into bands and call function(begin, end) for each band on worker threads
+   *
+   * The calling thread also processes bands and returns after all bands are finished.
+   * Calls from multiple threads are serialized.
+   */
+  void parallelFor(int count, const std::function<void(int, int)>& function);
+
+private:
+  struct Job;
+
+  std::vector<std::thread> _workers;
+
+  /**
+   * \brief Serializes parallelFor() calls
+   */
+  std::mutex _call_mutex;
+
+  std::mutex _mutex;
+  std::condition_variable _job_condition;
+  std::condition_variable _finish_condition;
+  std::shared_ptr<Job> _job;
+  uint64_t _job_id;
+  bool _stop;
+
+  void processBands(Job& job);
+  void workerLoop();
+};
+
+} // namespace disparity_image_proc
+
+#endif // DISPARITY_IMAGE_PROC_THREAD_POOL_H
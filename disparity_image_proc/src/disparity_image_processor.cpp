@@ -1,17 +1,131 @@
 #include <disparity_image_proc/disparity_image_processor.h>
 
-DisparityImageProcessor::DisparityImageProcessor(const stereo_msgs::DisparityImageConstPtr& disparity_msg, const sensor_msgs::CameraInfoConstPtr& left_camera_info) : _disparity_msg(*disparity_msg)
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+
+namespace
 {
-  _disparity_map = cv::Mat_<float>(_disparity_msg.image.height, _disparity_msg.image.width, (float*)&_disparity_msg.image.data[0], _disparity_msg.image.step);
-  
-  _left_camera_model.fromCameraInfo(left_camera_info);
+
+/**
+ * \brief Number of depth tables cached by getDepthTable(), and validity masks kept by the pool
+ */
+const size_t MAX_CACHED_BUFFERS = 8;
+
+struct ValidityMaskPool
+{
+  std::mutex mutex;
+  std::vector<std::vector<uint64_t>> masks;
+};
+
+ValidityMaskPool& validityMaskPool()
+{
+  // Never destroyed, so processors destroyed at exit can still return their masks
+  static ValidityMaskPool* pool = new ValidityMaskPool();
+  return *pool;
 }
 
-DisparityImageProcessor::DisparityImageProcessor(const stereo_msgs::DisparityImage& disparity_msg, const sensor_msgs::CameraInfo& left_camera_info) : _disparity_msg(disparity_msg)
+/**
+ * \brief Take an empty mask which keeps memory of a destroyed processor
+ */
+std::vector<uint64_t> acquireValidityMask()
 {
-  _disparity_map = cv::Mat_<float>(_disparity_msg.image.height, _disparity_msg.image.width, (float*)&_disparity_msg.image.data[0], _disparity_msg.image.step);
-  
-  _left_camera_model.fromCameraInfo(left_camera_info);
+  ValidityMaskPool& pool = validityMaskPool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  std::vector<uint64_t> mask;
+  if (!pool.masks.empty())
+  {
+    mask.swap(pool.masks.back());
+    pool.masks.pop_back();
+  }
+  mask.clear();
+  return mask;
+}
+
+void releaseValidityMask(std::vector<uint64_t>& mask)
+{
+  // Moved-from processors have nothing to return
+  if (mask.capacity() == 0)
+    return;
+
+  ValidityMaskPool& pool = validityMaskPool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  // Capacity of the pool is reserved once, so returning a mask doesn't allocate
+  pool.masks.reserve(MAX_CACHED_BUFFERS);
+  if (pool.masks.size() < MAX_CACHED_BUFFERS)
+  {
+    pool.masks.emplace_back();
+    pool.masks.back().swap(mask);
+  }
+}
+
+/**
+ * \brief Get a depth table shared by all processors of the same camera, disparity range and step
+ */
+std::shared_ptr<const std::vector<float>> getDepthTable(const disparity_image_proc::ReprojectionParams& params, float disparity_step)
+{
+  struct Entry
+  {
+    disparity_image_proc::ReprojectionParams params;
+    float disparity_step;
+    std::shared_ptr<const std::vector<float>> table;
+  };
+  // Processors of now and previous frame are created on different threads
+  static std::mutex cache_mutex;
+  static std::list<Entry> cache;
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto found = std::find_if(cache.begin(), cache.end(), [&](const Entry& entry)
+  {
+    return entry.params.focal_baseline == params.focal_baseline && entry.params.min_disparity == params.min_disparity
+      && entry.params.max_disparity == params.max_disparity && entry.disparity_step == disparity_step;
+  });
+
+  // The most recently used table is kept at the front, and the least recently used one is evicted
+  if (found != cache.end())
+    cache.splice(cache.begin(), cache, found);
+  else
+  {
+    std::shared_ptr<std::vector<float>> table = std::make_shared<std::vector<float>>();
+    disparity_image_proc::buildDepthTable(params, disparity_step, *table);
+    cache.push_front(Entry{params, disparity_step, table});
+    if (cache.size() > MAX_CACHED_BUFFERS)
+      cache.pop_back();
+  }
+
+  return cache.front().table;
+}
+
+} // namespace
+
+DisparityImageProcessor::DisparityImageProcessor(const stereo_msgs::DisparityImageConstPtr& disparity_msg, const sensor_msgs::CameraInfoConstPtr& left_camera_info) : _disparity_msg(disparity_msg)
+{
+  // SGM outputs disparity quantized by delta_d, which enables depth lookup table where it's faster than division
+  initialize(*left_camera_info, disparity_image_proc::isDepthTableFasterThanDivision() ? disparity_msg->delta_d : 0.0f);
+}
+
+DisparityImageProcessor::DisparityImageProcessor(const stereo_msgs::DisparityImage& disparity_msg, const sensor_msgs::CameraInfo& left_camera_info) : _disparity_msg(new stereo_msgs::DisparityImage(disparity_msg))
+{
+  initialize(left_camera_info, disparity_image_proc::isDepthTableFasterThanDivision() ? disparity_msg.delta_d : 0.0f);
+}
+
+DisparityImageProcessor::DisparityImageProcessor(const stereo_msgs::DisparityImageConstPtr& disparity_info, const cv::Mat& fixed_point_disparity, int fractional_bits, const sensor_msgs::CameraInfoConstPtr& left_camera_info) : _disparity_msg(disparity_info), _disparity_map(fixed_point_disparity)
+{
+  if (fixed_point_disparity.type() != CV_16SC1)
+    throw std::invalid_argument("Fixed-point disparity must be CV_16SC1");
+  // More bits leave too few integer bits of int16_t for disparity range of stereo matching
+  if (fractional_bits < 0 || fractional_bits > 8)
+    throw std::invalid_argument("Fractional bits of fixed-point disparity must be from 0 to 8");
+
+  initialize(*left_camera_info, 1.0f / (1 << fractional_bits));
+}
+
+DisparityImageProcessor::~DisparityImageProcessor()
+{
+  releaseValidityMask(_validity_mask);
 }
 
 bool DisparityImageProcessor::getDisparity(int u, int v, float& disparity)
@@ -20,11 +134,14 @@ bool DisparityImageProcessor::getDisparity(int u, int v, float& disparity)
     return false;
   if (v < 0 || v >= getHeight())
     return false;
-  disparity = _disparity_map.at<float>(v, u);
+  if (_disparity_map.type() == CV_16SC1)
+    disparity = _disparity_map.at<int16_t>(v, u) * _disparity_step;
+  else
+    disparity = _disparity_map.at<float>(v, u);
   
-  if (_disparity_msg.max_disparity < disparity)
+  if (_disparity_msg->max_disparity < disparity)
     return false;
-  else if (_disparity_msg.min_disparity > disparity)
+  else if (_disparity_msg->min_disparity > disparity)
     return false;
   
   return true;
@@ -32,39 +149,26 @@ bool DisparityImageProcessor::getDisparity(int u, int v, float& disparity)
 
 bool DisparityImageProcessor::getPoint3D(int u, int v, pcl::PointXYZ &point3d)
 {
-  float disparity;
-  if (!getDisparity(u, v, disparity))
-    return false;
-  if (disparity == 0.0)
+  if (!isValidPixel(u, v))
     return false;
 
-  float focal_length = _disparity_msg.f;
-  float baseline = _disparity_msg.T;
-  
-  point3d.z = focal_length * baseline / disparity;
-  cv::Point3d direction_vector = _left_camera_model.projectPixelTo3dRay(cv::Point2d(u, v));
-  point3d.x = direction_vector.x * point3d.z;
-  point3d.y = direction_vector.y * point3d.z;
+  point3d.z = getDepth(u, v);
+  point3d.x = _ray_table->rayX(u) * point3d.z;
+  point3d.y = _ray_table->rayY(v) * point3d.z;
 
   return true;
 }
 
 bool DisparityImageProcessor::getPoint3D(int u, int v, tf2::Vector3& point3d)
 {
-  float disparity;
-  if (!getDisparity(u, v, disparity))
-    return false;
-  if (disparity == 0.0)
+  if (!isValidPixel(u, v))
     return false;
-  float focal_length = _disparity_msg.f;
-  float baseline = _disparity_msg.T;
-  
-  float z = focal_length * baseline / disparity;
+
+  float z = getDepth(u, v);
   // a vector faces the point in 3D coordinate
   // vector.z == 1.0
-  cv::Point3d direction_vector = _left_camera_model.projectPixelTo3dRay(cv::Point2d(u, v));
-  float x = direction_vector.x * z;
-  float y = direction_vector.y * z;
+  float x = _ray_table->rayX(u) * z;
+  float y = _ray_table->rayY(v) * z;
   
   point3d.setX(x);
   point3d.setY(y);
@@ -73,6 +177,22 @@ bool DisparityImageProcessor::getPoint3D(int u, int v, tf2::Vector3& point3d)
   return true;
 }
 
+float DisparityImageProcessor::getDepth(int u, int v)
+{
+  // Valid fixed-point disparity is always in the table
+  if (_disparity_map.type() == CV_16SC1)
+    return (*_depth_table)[_disparity_map.at<int16_t>(v, u)];
+
+  float disparity = _disparity_map.at<float>(v, u);
+  if (_depth_table)
+  {
+    float index = disparity * _disparity_step_inverse;
+    if (index >= 0.0f && index < _depth_table->size() && index == static_cast<int>(index))
+      return (*_depth_table)[static_cast<int>(index)];
+  }
+  return _disparity_msg->f * _disparity_msg->T / disparity;
+}
+
 int DisparityImageProcessor::getWidth()
 {
   return _disparity_map.cols;
@@ -83,39 +203,490 @@ int DisparityImageProcessor::getHeight()
   return _disparity_map.rows;
 }
 
+const uint64_t* DisparityImageProcessor::getValidityMaskRow(int v)
+{
+  return _validity_mask.data() + v * _validity_mask_stride;
+}
+
+int DisparityImageProcessor::getValidityMaskStride()
+{
+  return _validity_mask_stride;
+}
+
+float DisparityImageProcessor::getDisparityStep()
+{
+  return _disparity_step;
+}
+
+disparity_image_proc::ReprojectionParams DisparityImageProcessor::getReprojectionParams()
+{
+  disparity_image_proc::ReprojectionParams params;
+  params.focal_baseline = _disparity_msg->f * _disparity_msg->T;
+  params.min_disparity = _disparity_msg->min_disparity;
+  params.max_disparity = _disparity_msg->max_disparity;
+  if (!_depth_table)
+  {
+    params.depth_table = nullptr;
+    params.depth_table_size = 0;
+    params.disparity_step_inverse = 0.0f;
+  }
+  else
+  {
+    params.depth_table = _depth_table->data();
+    params.depth_table_size = _depth_table->size();
+    params.disparity_step_inverse = _disparity_step_inverse;
+  }
+  return params;
+}
+
+void DisparityImageProcessor::setDisparityStep(float disparity_step)
+{
+  if (_disparity_map.type() == CV_16SC1 && !(disparity_step > 0.0f))
+    throw std::invalid_argument("Fixed-point disparity needs positive disparity step");
+
+  if (disparity_step > 0.0f)
+  {
+    _disparity_step = disparity_step;
+    _disparity_step_inverse = 1.0f / disparity_step;
+    _depth_table.reset();
+    _depth_table = getDepthTable(getReprojectionParams(), disparity_step);
+  }
+  else
+  {
+    _disparity_step = 0.0f;
+    _disparity_step_inverse = 0.0f;
+    _depth_table.reset();
+  }
+
+  // Validity of fixed-point disparity depends on the depth table
+  if (_validity_mask.empty() || _disparity_map.type() == CV_16SC1)
+    updateValidityMask();
+}
+
+void DisparityImageProcessor::updateValidityMask()
+{
+  int height = getHeight();
+  _validity_mask_stride = (getWidth() + 63) / 64;
+  _validity_mask.resize(_validity_mask_stride * height);
+
+  disparity_image_proc::ReprojectionParams params = getReprojectionParams();
+  for (int v = 0; v < height; v++)
+  {
+    uint64_t* mask_row = &_validity_mask[v * _validity_mask_stride];
+    if (_disparity_map.type() == CV_16SC1)
+      disparity_image_proc::validityMaskFixedPointRow(_disparity_map.ptr<int16_t>(v), getWidth(), params, mask_row);
+    else
+      disparity_image_proc::validityMaskRow(_disparity_map.ptr<float>(v), getWidth(), params, mask_row);
+  }
+}
+
 void DisparityImageProcessor::toPointCloud(pcl::PointCloud<pcl::PointXYZ> &pointcloud)
 {
-  float nan = std::nan("");
-  pcl::PointXYZ default_value(nan, nan, nan);
-  // 画像座標との対応関係を残すため，organizedなpointcloudを構築する
-  pointcloud = pcl::PointCloud<pcl::PointXYZ>(getWidth(), getHeight(), default_value);
-  pointcloud.is_dense = false;
-  
-  for (int u = 0; u < getWidth(); u++)
+  int width = getWidth();
+  int height = getHeight();
+  resizeOrganizedPointCloud(pointcloud, width, height);
+
+  // Row-major order to follow memory layout of both disparity image and organized pointcloud
+  for (int v = 0; v < height; v++)
+    reprojectImageRow(v, 0, width, pointcloud.points[v * width].data, nullptr, nullptr);
+}
+
+void DisparityImageProcessor::toDepthImage(cv::Mat& depth_image)
+{
+  int width = getWidth();
+  int height = getHeight();
+  depth_image.create(height, width, CV_32FC1);
+
+  for (int v = 0; v < height; v++)
+    reprojectImageRow(v, 0, width, nullptr, depth_image.ptr<float>(v), nullptr);
+}
+
+void DisparityImageProcessor::toPointCloudAndDepthImage(pcl::PointCloud<pcl::PointXYZ> &pointcloud, cv::Mat& depth_image, cv::Mat* valid_mask)
+{
+  int width = getWidth();
+  int height = getHeight();
+  resizeOrganizedPointCloud(pointcloud, width, height);
+  depth_image.create(height, width, CV_32FC1);
+  if (valid_mask)
+    valid_mask->create(height, width, CV_8UC1);
+
+  for (int v = 0; v < height; v++)
+  {
+    unsigned char* valid_row = valid_mask ? valid_mask->ptr<unsigned char>(v) : nullptr;
+    reprojectImageRow(v, 0, width, pointcloud.points[v * width].data, depth_image.ptr<float>(v), valid_row);
+  }
+}
+
+void DisparityImageProcessor::toPointCloud(pcl::PointCloud<pcl::PointXYZ> &pointcloud, disparity_image_proc::ThreadPool& thread_pool)
+{
+  int width = getWidth();
+  int height = getHeight();
+  resizeOrganizedPointCloud(pointcloud, width, height);
+
+  // Each band writes its own rows, so the result doesn't depend on scheduling
+  thread_pool.parallelFor(height, [&](int v_begin, int v_end)
+  {
+    for (int v = v_begin; v < v_end; v++)
+      reprojectImageRow(v, 0, width, pointcloud.points[v * width].data, nullptr, nullptr);
+  });
+}
+
+void DisparityImageProcessor::toPointCloudAndDepthImage(pcl::PointCloud<pcl::PointXYZ> &pointcloud, cv::Mat& depth_image, disparity_image_proc::ThreadPool& thread_pool, cv::Mat* valid_mask)
+{
+  int width = getWidth();
+  int height = getHeight();
+  resizeOrganizedPointCloud(pointcloud, width, height);
+  depth_image.create(height, width, CV_32FC1);
+  if (valid_mask)
+    valid_mask->create(height, width, CV_8UC1);
+
+  thread_pool.parallelFor(height, [&](int v_begin, int v_end)
   {
-    for (int v = 0; v < getHeight(); v++)
+    for (int v = v_begin; v < v_end; v++)
     {
-      pcl::PointXYZ point;
-      if (getPoint3D(u, v, point))
-        pointcloud.at(u, v) = point;
+      unsigned char* valid_row = valid_mask ? valid_mask->ptr<unsigned char>(v) : nullptr;
+      reprojectImageRow(v, 0, width, pointcloud.points[v * width].data, depth_image.ptr<float>(v), valid_row);
     }
+  });
+}
+
+void DisparityImageProcessor::initialize(const sensor_msgs::CameraInfo& left_camera_info, float disparity_step)
+{
+  _validity_mask = acquireValidityMask();
+
+  // Fixed-point disparity is given by the constructor
+  if (_disparity_map.empty())
+  {
+    // cv::Mat doesn't modify the data, so constness of the message is kept in practice
+    const sensor_msgs::Image& image = _disparity_msg->image;
+    _disparity_map = cv::Mat_<float>(image.height, image.width, (float*)&image.data[0], image.step);
   }
+
+  _left_camera_model.fromCameraInfo(left_camera_info);
+  _ray_table = RayLookupTable::get(_left_camera_model, getWidth(), getHeight());
+
+  setDisparityStep(disparity_step);
 }
 
-void DisparityImageProcessor::toDepthImage(cv::Mat& depth_image)
+void DisparityImageProcessor::reprojectImageRow(int v, int u_begin, int u_end, float* points, float* depth, unsigned char* valid)
+{
+  const float* ray_x = _ray_table->rayXData() + u_begin;
+  if (_disparity_map.type() == CV_16SC1)
+    disparity_image_proc::reprojectFixedPointRow(_disparity_map.ptr<int16_t>(v) + u_begin, u_end - u_begin, ray_x, _ray_table->rayY(v), getReprojectionParams(), points, depth, valid);
+  else
+    disparity_image_proc::reprojectRow(_disparity_map.ptr<float>(v) + u_begin, u_end - u_begin, ray_x, _ray_table->rayY(v), getReprojectionParams(), points, depth, valid);
+}
+
+void DisparityImageProcessor::resizeOrganizedPointCloud(pcl::PointCloud<pcl::PointXYZ> &pointcloud, int width, int height)
 {
-  float nan = std::nan("");
+  static_assert(sizeof(pcl::PointXYZ) == 4 * sizeof(float), "reprojectRow() assumes pcl::PointXYZ is (x, y, z, padding)");
+
   // 画像座標との対応関係を残すため，organizedなpointcloudを構築する
-  depth_image.create(getHeight(), getWidth(), CV_32FC1);
-  for (int u = 0; u < getWidth(); u++)
+  // Invalid pixels are filled by NaN in reprojectRow(), so initialization of points is not needed
+  pointcloud.points.resize(width * height);
+  pointcloud.width = width;
+  pointcloud.height = height;
+  pointcloud.is_dense = false;
+}
+
+void DisparityImageProcessor::toPointCloud(const cv::Mat& mask, pcl::PointCloud<pcl::PointXYZ> &pointcloud)
+{
+  int width = getWidth();
+  int height = getHeight();
+  if (mask.type() != CV_8UC1 || mask.cols != width || mask.rows != height)
+    throw std::invalid_argument("Mask must be CV_8UC1 image of same size as disparity image");
+
+  resizeOrganizedPointCloud(pointcloud, width, height);
+
+  for (int v = 0; v < height; v++)
   {
-    for (int v = 0; v < getHeight(); v++)
+    const unsigned char* mask_row = mask.ptr<unsigned char>(v);
+    float* points_row = pointcloud.points[v * width].data;
+
+    // Process each run of selected or unselected pixels at once
+    int u = 0;
+    while (u < width)
     {
-      pcl::PointXYZ point;
-      if (getPoint3D(u, v, point))
-        depth_image.at<float>(v, u) = point.z;
+      int run_end = u + 1;
+      while (run_end < width && (mask_row[run_end] != 0) == (mask_row[u] != 0))
+        run_end++;
+
+      if (mask_row[u] != 0)
+        reprojectImageRow(v, u, run_end, points_row + 4 * u, nullptr, nullptr);
       else
-        depth_image.at<float>(v, u) = nan;
+        fillInvalidPoints(points_row + 4 * u, run_end - u);
+
+      u = run_end;
+    }
+  }
+}
+
+void DisparityImageProcessor::toPointCloud(const std::vector<cv::Rect>& rois, pcl::PointCloud<pcl::PointXYZ> &pointcloud)
+{
+  int width = getWidth();
+  int height = getHeight();
+  resizeOrganizedPointCloud(pointcloud, width, height);
+  if (pointcloud.points.empty())
+    return;
+  fillInvalidPoints(pointcloud.points.data()->data, width * height);
+
+  for (const cv::Rect& roi : clipRegions(rois))
+  {
+    for (int v = roi.y; v < roi.y + roi.height; v++)
+      reprojectImageRow(v, roi.x, roi.x + roi.width, pointcloud.points[v * width + roi.x].data, nullptr, nullptr);
+  }
+}
+
+void DisparityImageProcessor::toIndexedPointCloud(const cv::Mat& mask, pcl::PointCloud<pcl::PointXYZ> &pointcloud, std::vector<int>& indices)
+{
+  int width = getWidth();
+  int height = getHeight();
+  if (mask.type() != CV_8UC1 || mask.cols != width || mask.rows != height)
+    throw std::invalid_argument("Mask must be CV_8UC1 image of same size as disparity image");
+
+  pointcloud.clear();
+  indices.clear();
+
+  for (int v = 0; v < height; v++)
+  {
+    const unsigned char* mask_row = mask.ptr<unsigned char>(v);
+
+    int u = 0;
+    while (u < width)
+    {
+      if (mask_row[u] == 0)
+      {
+        u++;
+        continue;
+      }
+
+      int run_end = u + 1;
+      while (run_end < width && mask_row[run_end] != 0)
+        run_end++;
+
+      appendValidPoints(v, u, run_end, pointcloud, indices);
+      u = run_end;
+    }
+  }
+}
+
+void DisparityImageProcessor::toIndexedPointCloud(const std::vector<cv::Rect>& rois, pcl::PointCloud<pcl::PointXYZ> &pointcloud, std::vector<int>& indices)
+{
+  pointcloud.clear();
+  indices.clear();
+
+  for (const cv::Rect& roi : clipRegions(rois))
+  {
+    for (int v = roi.y; v < roi.y + roi.height; v++)
+      appendValidPoints(v, roi.x, roi.x + roi.width, pointcloud, indices);
+  }
+}
+
+void DisparityImageProcessor::toIndexedPointCloud(const std::vector<int>& pixel_indices, pcl::PointCloud<pcl::PointXYZ> &pointcloud, std::vector<int>& indices)
+{
+  int width = getWidth();
+  int pixel_count = width * getHeight();
+
+  pointcloud.clear();
+  indices.clear();
+
+  size_t i = 0;
+  while (i < pixel_indices.size())
+  {
+    int pixel_index = pixel_indices[i];
+    if (pixel_index < 0 || pixel_index >= pixel_count)
+    {
+      i++;
+      continue;
+    }
+
+    // Consecutive indices in the same row are reprojected at once
+    int v = pixel_index / width;
+    int u_begin = pixel_index % width;
+    int u_end = u_begin + 1;
+    i++;
+    while (i < pixel_indices.size() && pixel_indices[i] == v * width + u_end && u_end < width)
+    {
+      u_end++;
+      i++;
+    }
+
+    appendValidPoints(v, u_begin, u_end, pointcloud, indices);
+  }
+}
+
+void DisparityImageProcessor::appendValidPoints(int v, int u_begin, int u_end, pcl::PointCloud<pcl::PointXYZ> &pointcloud, std::vector<int>& indices)
+{
+  int length = u_end - u_begin;
+  size_t begin = pointcloud.points.size();
+  pointcloud.points.resize(begin + length);
+  reprojectImageRow(v, u_begin, u_end, pointcloud.points[begin].data, nullptr, nullptr);
+
+  // Invalid pixels are NaN, and valid points are moved forward over them
+  size_t end = begin;
+  for (int i = 0; i < length; i++)
+  {
+    if (std::isnan(pointcloud.points[begin + i].z))
+      continue;
+    pointcloud.points[end++] = pointcloud.points[begin + i];
+    indices.push_back(v * getWidth() + u_begin + i);
+  }
+  pointcloud.points.resize(end);
+
+  pointcloud.width = pointcloud.points.size();
+  pointcloud.height = 1;
+  pointcloud.is_dense = true;
+}
+
+std::vector<cv::Rect> DisparityImageProcessor::clipRegions(const std::vector<cv::Rect>& rois)
+{
+  cv::Rect image_region(0, 0, getWidth(), getHeight());
+
+  std::vector<cv::Rect> clipped_rois;
+  for (const cv::Rect& roi : rois)
+  {
+    cv::Rect clipped = roi & image_region;
+    if (clipped.area() > 0)
+      clipped_rois.push_back(clipped);
+  }
+  return clipped_rois;
+}
+
+void DisparityImageProcessor::fillInvalidPoints(float* points, int count)
+{
+  float nan = std::nanf("");
+  for (int i = 0; i < count; i++)
+  {
+    points[4 * i] = nan;
+    points[4 * i + 1] = nan;
+    points[4 * i + 2] = nan;
+    points[4 * i + 3] = 1.0f;
+  }
+}
+
+template <typename DisparityT> void DisparityImageProcessor::decimateRow(int v_block, int decimation, DecimationMethod method, std::vector<DisparityT>& output)
+{
+  int width = getWidth() / decimation;
+  output.resize(width);
+
+  if (method == DecimationMethod::SAMPLE)
+  {
+    const DisparityT* disparity_row = _disparity_map.ptr<DisparityT>(v_block * decimation);
+    for (int u_block = 0; u_block < width; u_block++)
+      output[u_block] = disparity_row[u_block * decimation];
+    return;
+  }
+
+  const DisparityT invalid_value = std::is_floating_point<DisparityT>::value ? std::nanf("") : -1;
+  std::vector<DisparityT> block_values;
+  block_values.reserve(decimation * decimation);
+  for (int u_block = 0; u_block < width; u_block++)
+  {
+    block_values.clear();
+    for (int v = v_block * decimation; v < (v_block + 1) * decimation; v++)
+    {
+      const DisparityT* disparity_row = _disparity_map.ptr<DisparityT>(v);
+      for (int u = u_block * decimation; u < (u_block + 1) * decimation; u++)
+      {
+        if (isValidDisparity(disparity_row[u]))
+          block_values.push_back(disparity_row[u]);
+      }
     }
+
+    if (block_values.empty())
+    {
+      output[u_block] = invalid_value;
+      continue;
+    }
+
+    // Lower median keeps disparity on quantization step
+    auto median = block_values.begin() + (block_values.size() - 1) / 2;
+    std::nth_element(block_values.begin(), median, block_values.end());
+    output[u_block] = *median;
   }
-}
\ No newline at end of file
+}
+
+void DisparityImageProcessor::toPointCloud(pcl::PointCloud<pcl::PointXYZ> &pointcloud, int decimation, DecimationMethod method)
+{
+  if (decimation < 1)
+    throw std::invalid_argument("Decimation must be positive");
+
+  int width = getWidth() / decimation;
+  int height = getHeight() / decimation;
+  resizeOrganizedPointCloud(pointcloud, width, height);
+  // Image smaller than a block has no point
+  if (pointcloud.points.empty())
+    return;
+
+  // Rays through top-left pixel or center of blocks.
+  // Ray is linear to pixel coordinate, so ray through the center is average of the block.
+  std::vector<float> ray_x(width);
+  for (int u_block = 0; u_block < width; u_block++)
+  {
+    if (method == DecimationMethod::SAMPLE)
+      ray_x[u_block] = _ray_table->rayX(u_block * decimation);
+    else
+      ray_x[u_block] = (_ray_table->rayX(u_block * decimation) + _ray_table->rayX((u_block + 1) * decimation - 1)) / 2.0f;
+  }
+
+  disparity_image_proc::ReprojectionParams params = getReprojectionParams();
+  std::vector<float> float_row;
+  std::vector<int16_t> fixed_point_row;
+  for (int v_block = 0; v_block < height; v_block++)
+  {
+    float ray_y;
+    if (method == DecimationMethod::SAMPLE)
+      ray_y = _ray_table->rayY(v_block * decimation);
+    else
+      ray_y = (_ray_table->rayY(v_block * decimation) + _ray_table->rayY((v_block + 1) * decimation - 1)) / 2.0f;
+
+    float* points_row = pointcloud.points[v_block * width].data;
+    if (_disparity_map.type() == CV_16SC1)
+    {
+      decimateRow(v_block, decimation, method, fixed_point_row);
+      disparity_image_proc::reprojectFixedPointRow(fixed_point_row.data(), width, ray_x.data(), ray_y, params, points_row, nullptr);
+    }
+    else
+    {
+      decimateRow(v_block, decimation, method, float_row);
+      disparity_image_proc::reprojectRow(float_row.data(), width, ray_x.data(), ray_y, params, points_row, nullptr);
+    }
+  }
+}
+
+void DisparityImageProcessor::getDecimatedCameraInfo(int decimation, DecimationMethod method, sensor_msgs::CameraInfo& camera_info)
+{
+  if (decimation < 1)
+    throw std::invalid_argument("Decimation must be positive");
+
+  camera_info = _left_camera_model.cameraInfo();
+  camera_info.width = getWidth() / decimation;
+  camera_info.height = getHeight() / decimation;
+
+  // Pixel u of decimated image is pixel (u * decimation + offset) of original image
+  double offset = method == DecimationMethod::SAMPLE ? 0.0 : (decimation - 1) / 2.0;
+  double scale = 1.0 / decimation;
+
+  // fx, cx, fy, cy
+  camera_info.K[0] *= scale;
+  camera_info.K[2] = (camera_info.K[2] - offset) * scale;
+  camera_info.K[4] *= scale;
+  camera_info.K[5] = (camera_info.K[5] - offset) * scale;
+  // fx', cx', Tx, fy', cy', Ty
+  camera_info.P[0] *= scale;
+  camera_info.P[2] = (camera_info.P[2] - offset) * scale;
+  camera_info.P[3] *= scale;
+  camera_info.P[5] *= scale;
+  camera_info.P[6] = (camera_info.P[6] - offset) * scale;
+  camera_info.P[7] *= scale;
+}
+
+bool DisparityImageProcessor::isValidDisparity(float disparity)
+{
+  return disparity >= _disparity_msg->min_disparity && disparity <= _disparity_msg->max_disparity && disparity != 0.0f;
+}
+
+bool DisparityImageProcessor::isValidDisparity(int16_t fixed_point_disparity)
+{
+  return fixed_point_disparity >= 0 && fixed_point_disparity < static_cast<int>(_depth_table->size()) && !std::isnan((*_depth_table)[fixed_point_disparity]);
+}
@@ -0,0 +1,70 @@
+#include <disparity_image_proc/ray_lookup_table.h>
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+
+RayLookupTable::RayLookupTable(const image_geometry::PinholeCameraModel& camera_model, int width, int height) : _camera_info(camera_model.cameraInfo())
+{
+  _ray_x.resize(width);
+  for (int u = 0; u < width; u++)
+    _ray_x[u] = camera_model.projectPixelTo3dRay(cv::Point2d(u, 0)).x;
+
+  _ray_y.resize(height);
+  for (int v = 0; v < height; v++)
+    _ray_y[v] = camera_model.projectPixelTo3dRay(cv::Point2d(0, v)).y;
+}
+
+std::shared_ptr<const RayLookupTable> RayLookupTable::get(const image_geometry::PinholeCameraModel& camera_model, int width, int height)
+{
+  // Processors of now and previous frame are created on different threads,
+  // and processors of several cameras can live in one process (e.g. nodelets in one manager)
+  static std::mutex cache_mutex;
+  static std::list<std::shared_ptr<const RayLookupTable>> cache;
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto found = std::find_if(cache.begin(), cache.end(), [&](const std::shared_ptr<const RayLookupTable>& table)
+  {
+    return table->isCompatible(camera_model.cameraInfo(), width, height);
+  });
+
+  // The most recently used table is kept at the front, and the least recently used one is evicted
+  if (found != cache.end())
+    cache.splice(cache.begin(), cache, found);
+  else
+  {
+    cache.push_front(std::make_shared<const RayLookupTable>(camera_model, width, height));
+    if (cache.size() > MAX_CACHED_TABLES)
+      cache.pop_back();
+  }
+
+  return cache.front();
+}
+
+int RayLookupTable::getWidth() const
+{
+  return _ray_x.size();
+}
+
+int RayLookupTable::getHeight() const
+{
+  return _ray_y.size();
+}
+
+bool RayLookupTable::isCompatible(const sensor_msgs::CameraInfo& camera_info, int width, int height) const
+{
+  if (width != getWidth() || height != getHeight())
+    return false;
+
+  // Only projection matrix, binning and ROI are used by projectPixelTo3dRay()
+  if (!std::equal(camera_info.P.begin(), camera_info.P.end(), _camera_info.P.begin()))
+    return false;
+  if (camera_info.binning_x != _camera_info.binning_x || camera_info.binning_y != _camera_info.binning_y)
+    return false;
+  if (camera_info.roi.x_offset != _camera_info.roi.x_offset || camera_info.roi.y_offset != _camera_info.roi.y_offset)
+    return false;
+  if (camera_info.roi.width != _camera_info.roi.width || camera_info.roi.height != _camera_info.roi.height)
+    return false;
+
+  return true;
+}
@@ -0,0 +1,440 @@
+#include <disparity_image_proc/reprojection_kernel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace disparity_image_proc
+{
+
+namespace
+{
+
+/**
+ * \brief Maximum number of entries of depth table
+ */
+const int MAX_DEPTH_TABLE_SIZE = 1 << 16;
+
+inline bool isValidDisparity(float disparity, const ReprojectionParams& params)
+{
+  return disparity >= params.min_disparity && disparity <= params.max_disparity && disparity != 0.0f;
+}
+
+inline bool isValidFixedPointDisparity(int16_t disparity, const ReprojectionParams& params)
+{
+  return disparity >= 0 && disparity < params.depth_table_size && !std::isnan(params.depth_table[disparity]);
+}
+
+inline void storePixel(float z, float ray_x, float ray_y, float* point, float* depth, unsigned char* valid, bool is_valid)
+{
+  if (point)
+  {
+    point[0] = ray_x * z;
+    point[1] = ray_y * z;
+    point[2] = z;
+    point[3] = 1.0f;
+  }
+  if (depth)
+    *depth = z;
+  if (valid)
+    *valid = is_valid ? 255 : 0;
+}
+
+inline void reprojectPixel(float disparity, float ray_x, float ray_y, const ReprojectionParams& params, float* point, float* depth, unsigned char* valid)
+{
+  bool is_valid = isValidDisparity(disparity, params);
+  float z = std::numeric_limits<float>::quiet_NaN();
+
+  // Quantized disparity is converted to depth without division.
+  // Index is computed without branch, so invalid pixels scattered in the image don't cause misprediction.
+  bool in_table = false;
+  if (params.depth_table)
+  {
+    float index = disparity * params.disparity_step_inverse;
+    bool in_range = index >= 0.0f && index < params.depth_table_size;
+    int integer_index = in_range ? static_cast<int>(index) : 0;
+    in_table = in_range && index == integer_index;
+    float table_z = params.depth_table[integer_index];
+    z = in_table ? table_z : z;
+  }
+
+  // Only valid disparity off the quantization steps is divided
+  if (is_valid && !in_table)
+    z = params.focal_baseline / disparity;
+
+  storePixel(z, ray_x, ray_y, point, depth, valid, !std::isnan(z));
+}
+
+inline void reprojectFixedPointPixel(int16_t disparity, float ray_x, float ray_y, const ReprojectionParams& params, float* point, float* depth, unsigned char* valid)
+{
+  // Negative disparity (invalid value of SGM) and disparity out of the table are invalid
+  float z;
+  if (disparity >= 0 && disparity < params.depth_table_size)
+    z = params.depth_table[disparity];
+  else
+    z = std::numeric_limits<float>::quiet_NaN();
+
+  storePixel(z, ray_x, ray_y, point, depth, valid, !std::isnan(z));
+}
+
+#if defined(__AVX__) || defined(__SSE2__)
+/**
+ * \brief Store 4 points given as 4 vectors of x, y, z and w to (x, y, z, w) layout
+ */
+inline void storePoints(float* points, __m128 x, __m128 y, __m128 z, __m128 w)
+{
+  _MM_TRANSPOSE4_PS(x, y, z, w);
+  _mm_storeu_ps(points, x);
+  _mm_storeu_ps(points + 4, y);
+  _mm_storeu_ps(points + 8, z);
+  _mm_storeu_ps(points + 12, w);
+}
+
+/**
+ * \brief Expand sign bits given by movemask to 0 or 255 bytes
+ */
+inline void storeMask(unsigned char* valid, int bits, int length)
+{
+  for (int i = 0; i < length; i++)
+    valid[i] = (bits >> i) & 1 ? 255 : 0;
+}
+#endif
+
+/**
+ * \brief Reproject pixels from the beginning of the row by SIMD division
+ *
+ * \return Number of processed pixels, 0 without SIMD
+ */
+int reprojectPixelsByDivision(const float* disparity, int width, const float* ray_x, float ray_y, const ReprojectionParams& params, float* points, float* depth, unsigned char* valid)
+{
+  int u = 0;
+
+#if defined(__AVX__)
+  const __m256 focal_baseline8 = _mm256_set1_ps(params.focal_baseline);
+  const __m256 min_disparity8 = _mm256_set1_ps(params.min_disparity);
+  const __m256 max_disparity8 = _mm256_set1_ps(params.max_disparity);
+  const __m256 nan8 = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+  const __m256 ray_y8 = _mm256_set1_ps(ray_y);
+  const __m128 one4 = _mm_set1_ps(1.0f);
+
+  for (; u + 8 <= width; u += 8)
+  {
+    __m256 d = _mm256_loadu_ps(disparity + u);
+    // Comparisons with NaN are false, so NaN disparity is masked out
+    __m256 valid_mask = _mm256_and_ps(_mm256_cmp_ps(d, min_disparity8, _CMP_GE_OQ), _mm256_cmp_ps(d, max_disparity8, _CMP_LE_OQ));
+    valid_mask = _mm256_and_ps(valid_mask, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+    __m256 z = _mm256_blendv_ps(nan8, _mm256_div_ps(focal_baseline8, d), valid_mask);
+
+    if (depth)
+      _mm256_storeu_ps(depth + u, z);
+    if (valid)
+      storeMask(valid + u, _mm256_movemask_ps(valid_mask), 8);
+
+    if (points)
+    {
+      __m256 x = _mm256_mul_ps(_mm256_loadu_ps(ray_x + u), z);
+      __m256 y = _mm256_mul_ps(ray_y8, z);
+      float* out = points + 4 * u;
+      storePoints(out, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z), one4);
+      storePoints(out + 16, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1), one4);
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128 focal_baseline4 = _mm_set1_ps(params.focal_baseline);
+  const __m128 min_disparity4 = _mm_set1_ps(params.min_disparity);
+  const __m128 max_disparity4 = _mm_set1_ps(params.max_disparity);
+  const __m128 nan4 = _mm_set1_ps(std::numeric_limits<float>::quiet_NaN());
+  const __m128 ray_y4 = _mm_set1_ps(ray_y);
+  const __m128 one4 = _mm_set1_ps(1.0f);
+
+  for (; u + 4 <= width; u += 4)
+  {
+    __m128 d = _mm_loadu_ps(disparity + u);
+    // Comparisons with NaN are false, so NaN disparity is masked out
+    __m128 valid_mask = _mm_and_ps(_mm_cmpge_ps(d, min_disparity4), _mm_cmple_ps(d, max_disparity4));
+    valid_mask = _mm_andnot_ps(_mm_cmpeq_ps(d, _mm_setzero_ps()), valid_mask);
+    __m128 z = _mm_div_ps(focal_baseline4, d);
+    z = _mm_or_ps(_mm_and_ps(valid_mask, z), _mm_andnot_ps(valid_mask, nan4));
+
+    if (depth)
+      _mm_storeu_ps(depth + u, z);
+    if (valid)
+      storeMask(valid + u, _mm_movemask_ps(valid_mask), 4);
+
+    if (points)
+    {
+      __m128 x = _mm_mul_ps(_mm_loadu_ps(ray_x + u), z);
+      __m128 y = _mm_mul_ps(ray_y4, z);
+      storePoints(points + 4 * u, x, y, z, one4);
+    }
+  }
+#endif
+
+  return u;
+}
+
+/**
+ * \brief Reproject pixels from the beginning of the row by looking up depth table
+ *
+ * AVX2 gathers the table. SSE2 computes indices in vector and loads each entry.
+ * Valid disparity which is not on a quantization step is converted by division.
+ *
+ * \return Number of processed pixels, 0 without SIMD
+ */
+int reprojectQuantizedPixels(const float* disparity, int width, const float* ray_x, float ray_y, const ReprojectionParams& params, float* points, float* depth, unsigned char* valid)
+{
+  int u = 0;
+
+#if defined(__AVX2__)
+  const __m256 step_inverse8 = _mm256_set1_ps(params.disparity_step_inverse);
+  const __m256i table_size8 = _mm256_set1_epi32(params.depth_table_size);
+  const __m256 focal_baseline8 = _mm256_set1_ps(params.focal_baseline);
+  const __m256 min_disparity8 = _mm256_set1_ps(params.min_disparity);
+  const __m256 max_disparity8 = _mm256_set1_ps(params.max_disparity);
+  const __m256 nan8 = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+  const __m256 ray_y8 = _mm256_set1_ps(ray_y);
+  const __m128 one4 = _mm_set1_ps(1.0f);
+
+  for (; u + 8 <= width; u += 8)
+  {
+    __m256 d = _mm256_loadu_ps(disparity + u);
+    __m256 valid_mask = _mm256_and_ps(_mm256_cmp_ps(d, min_disparity8, _CMP_GE_OQ), _mm256_cmp_ps(d, max_disparity8, _CMP_LE_OQ));
+    valid_mask = _mm256_and_ps(valid_mask, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+
+    // Disparity on a quantization step with 0 <= index < depth_table_size is looked up, same as reprojectPixel()
+    __m256 index_float = _mm256_mul_ps(d, step_inverse8);
+    __m256i index = _mm256_cvttps_epi32(index_float);
+    __m256 on_step = _mm256_cmp_ps(_mm256_cvtepi32_ps(index), index_float, _CMP_EQ_OQ);
+    __m256i in_table = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), index), _mm256_cmpgt_epi32(table_size8, index));
+    __m256 lookup = _mm256_and_ps(on_step, _mm256_castsi256_ps(in_table));
+    __m256 z = _mm256_mask_i32gather_ps(nan8, params.depth_table, index, lookup, 4);
+
+    __m256 divide = _mm256_andnot_ps(lookup, valid_mask);
+    if (_mm256_movemask_ps(divide) != 0)
+      z = _mm256_blendv_ps(z, _mm256_div_ps(focal_baseline8, d), divide);
+
+    if (depth)
+      _mm256_storeu_ps(depth + u, z);
+    if (valid)
+      storeMask(valid + u, _mm256_movemask_ps(_mm256_cmp_ps(z, z, _CMP_ORD_Q)), 8);
+
+    if (points)
+    {
+      __m256 x = _mm256_mul_ps(_mm256_loadu_ps(ray_x + u), z);
+      __m256 y = _mm256_mul_ps(ray_y8, z);
+      float* out = points + 4 * u;
+      storePoints(out, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z), one4);
+      storePoints(out + 16, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1), one4);
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128 step_inverse4 = _mm_set1_ps(params.disparity_step_inverse);
+  const __m128i table_size4 = _mm_set1_epi32(params.depth_table_size);
+  const __m128 focal_baseline4 = _mm_set1_ps(params.focal_baseline);
+  const __m128 min_disparity4 = _mm_set1_ps(params.min_disparity);
+  const __m128 max_disparity4 = _mm_set1_ps(params.max_disparity);
+  const __m128 nan4 = _mm_set1_ps(std::numeric_limits<float>::quiet_NaN());
+  const __m128 ray_y4 = _mm_set1_ps(ray_y);
+  const __m128 one4 = _mm_set1_ps(1.0f);
+  alignas(16) int32_t indices[4];
+
+  for (; u + 4 <= width; u += 4)
+  {
+    __m128 d = _mm_loadu_ps(disparity + u);
+    __m128 valid_mask = _mm_and_ps(_mm_cmpge_ps(d, min_disparity4), _mm_cmple_ps(d, max_disparity4));
+    valid_mask = _mm_andnot_ps(_mm_cmpeq_ps(d, _mm_setzero_ps()), valid_mask);
+
+    __m128 index_float = _mm_mul_ps(d, step_inverse4);
+    __m128i index = _mm_cvttps_epi32(index_float);
+    __m128 on_step = _mm_cmpeq_ps(_mm_cvtepi32_ps(index), index_float);
+    __m128i in_table = _mm_andnot_si128(_mm_cmplt_epi32(index, _mm_setzero_si128()), _mm_cmplt_epi32(index, table_size4));
+    __m128 lookup = _mm_and_ps(on_step, _mm_castsi128_ps(in_table));
+
+    // Indices of other pixels are replaced by 0, so every load is inside the table
+    _mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_and_si128(index, _mm_castps_si128(lookup)));
+    __m128 z = _mm_setr_ps(params.depth_table[indices[0]], params.depth_table[indices[1]], params.depth_table[indices[2]], params.depth_table[indices[3]]);
+    z = _mm_or_ps(_mm_and_ps(lookup, z), _mm_andnot_ps(lookup, nan4));
+
+    __m128 divide = _mm_andnot_ps(lookup, valid_mask);
+    if (_mm_movemask_ps(divide) != 0)
+      z = _mm_or_ps(_mm_andnot_ps(divide, z), _mm_and_ps(divide, _mm_div_ps(focal_baseline4, d)));
+
+    if (depth)
+      _mm_storeu_ps(depth + u, z);
+    if (valid)
+      storeMask(valid + u, _mm_movemask_ps(_mm_cmpord_ps(z, z)), 4);
+
+    if (points)
+    {
+      __m128 x = _mm_mul_ps(_mm_loadu_ps(ray_x + u), z);
+      __m128 y = _mm_mul_ps(ray_y4, z);
+      storePoints(points + 4 * u, x, y, z, one4);
+    }
+  }
+#endif
+
+  return u;
+}
+
+} // namespace
+
+void buildDepthTable(const ReprojectionParams& params, float disparity_step, std::vector<float>& depth_table)
+{
+  int table_size = MAX_DEPTH_TABLE_SIZE;
+  if (std::isfinite(params.max_disparity) && params.max_disparity / disparity_step < MAX_DEPTH_TABLE_SIZE)
+    table_size = static_cast<int>(params.max_disparity / disparity_step) + 1;
+
+  depth_table.resize(table_size);
+  for (int i = 0; i < table_size; i++)
+  {
+    float disparity = i * disparity_step;
+    if (isValidDisparity(disparity, params))
+      depth_table[i] = params.focal_baseline / disparity;
+    else
+      depth_table[i] = std::numeric_limits<float>::quiet_NaN();
+  }
+}
+
+bool isDepthTableFasterThanDivision()
+{
+#if defined(__AVX2__)
+  return true;
+#else
+  return false;
+#endif
+}
+
+void reprojectRow(const float* disparity, int width, const float* ray_x, float ray_y, const ReprojectionParams& params, float* points, float* depth, unsigned char* valid)
+{
+  // Quantized disparity is converted by the depth table, and division is used only without the table
+  int u;
+  if (params.depth_table)
+    u = reprojectQuantizedPixels(disparity, width, ray_x, ray_y, params, points, depth, valid);
+  else
+    u = reprojectPixelsByDivision(disparity, width, ray_x, ray_y, params, points, depth, valid);
+
+  // Scalar code for the rest of the row, which also looks up the depth table if it's given
+  for (; u < width; u++)
+    reprojectPixel(disparity[u], ray_x[u], ray_y, params, points ? points + 4 * u : nullptr, depth ? depth + u : nullptr, valid ? valid + u : nullptr);
+}
+
+void reprojectFixedPointRow(const int16_t* disparity, int width, const float* ray_x, float ray_y, const ReprojectionParams& params, float* points, float* depth, unsigned char* valid)
+{
+  int u = 0;
+
+#if defined(__AVX2__)
+  const __m256 nan8 = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+  const __m256i table_size8 = _mm256_set1_epi32(params.depth_table_size);
+  const __m256 ray_y8 = _mm256_set1_ps(ray_y);
+  const __m128 one4 = _mm_set1_ps(1.0f);
+
+  for (; u + 8 <= width; u += 8)
+  {
+    __m256i index = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(disparity + u)));
+    // 0 <= index < depth_table_size
+    __m256i in_table = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), index), _mm256_cmpgt_epi32(table_size8, index));
+    __m256 z = _mm256_mask_i32gather_ps(nan8, params.depth_table, index, _mm256_castsi256_ps(in_table), 4);
+
+    if (depth)
+      _mm256_storeu_ps(depth + u, z);
+    if (valid)
+      storeMask(valid + u, _mm256_movemask_ps(_mm256_cmp_ps(z, z, _CMP_ORD_Q)), 8);
+
+    if (points)
+    {
+      __m256 x = _mm256_mul_ps(_mm256_loadu_ps(ray_x + u), z);
+      __m256 y = _mm256_mul_ps(ray_y8, z);
+      float* out = points + 4 * u;
+      storePoints(out, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z), one4);
+      storePoints(out + 16, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1), one4);
+    }
+  }
+#endif
+
+  // Table lookup is memory-bound, so scalar code is used without AVX2 gather
+  for (; u < width; u++)
+    reprojectFixedPointPixel(disparity[u], ray_x[u], ray_y, params, points ? points + 4 * u : nullptr, depth ? depth + u : nullptr, valid ? valid + u : nullptr);
+}
+
+void validityMaskRow(const float* disparity, int width, const ReprojectionParams& params, uint64_t* mask)
+{
+#if defined(__AVX__)
+  const __m256 min_disparity8 = _mm256_set1_ps(params.min_disparity);
+  const __m256 max_disparity8 = _mm256_set1_ps(params.max_disparity);
+#elif defined(__SSE2__)
+  const __m128 min_disparity4 = _mm_set1_ps(params.min_disparity);
+  const __m128 max_disparity4 = _mm_set1_ps(params.max_disparity);
+#endif
+
+  for (int word = 0; word < (width + 63) / 64; word++)
+  {
+    int u_begin = word * 64;
+    int u_end = std::min(u_begin + 64, width);
+    uint64_t bits = 0;
+    int u = u_begin;
+
+#if defined(__AVX__)
+    for (; u + 8 <= u_end; u += 8)
+    {
+      __m256 d = _mm256_loadu_ps(disparity + u);
+      __m256 valid_mask = _mm256_and_ps(_mm256_cmp_ps(d, min_disparity8, _CMP_GE_OQ), _mm256_cmp_ps(d, max_disparity8, _CMP_LE_OQ));
+      valid_mask = _mm256_and_ps(valid_mask, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+      bits |= static_cast<uint64_t>(_mm256_movemask_ps(valid_mask)) << (u - u_begin);
+    }
+#elif defined(__SSE2__)
+    for (; u + 4 <= u_end; u += 4)
+    {
+      __m128 d = _mm_loadu_ps(disparity + u);
+      __m128 valid_mask = _mm_and_ps(_mm_cmpge_ps(d, min_disparity4), _mm_cmple_ps(d, max_disparity4));
+      valid_mask = _mm_andnot_ps(_mm_cmpeq_ps(d, _mm_setzero_ps()), valid_mask);
+      bits |= static_cast<uint64_t>(_mm_movemask_ps(valid_mask)) << (u - u_begin);
+    }
+#endif
+
+    for (; u < u_end; u++)
+    {
+      if (isValidDisparity(disparity[u], params))
+        bits |= static_cast<uint64_t>(1) << (u - u_begin);
+    }
+    mask[word] = bits;
+  }
+}
+
+void validityMaskFixedPointRow(const int16_t* disparity, int width, const ReprojectionParams& params, uint64_t* mask)
+{
+#if defined(__AVX2__)
+  const __m256 nan8 = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+  const __m256i table_size8 = _mm256_set1_epi32(params.depth_table_size);
+#endif
+
+  for (int word = 0; word < (width + 63) / 64; word++)
+  {
+    int u_begin = word * 64;
+    int u_end = std::min(u_begin + 64, width);
+    uint64_t bits = 0;
+    int u = u_begin;
+
+#if defined(__AVX2__)
+    for (; u + 8 <= u_end; u += 8)
+    {
+      __m256i index = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(disparity + u)));
+      __m256i in_table = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), index), _mm256_cmpgt_epi32(table_size8, index));
+      __m256 z = _mm256_mask_i32gather_ps(nan8, params.depth_table, index, _mm256_castsi256_ps(in_table), 4);
+      bits |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(z, z, _CMP_ORD_Q))) << (u - u_begin);
+    }
+#endif
+
+    for (; u < u_end; u++)
+    {
+      if (isValidFixedPointDisparity(disparity[u], params))
+        bits |= static_cast<uint64_t>(1) << (u - u_begin);
+    }
+    mask[word] = bits;
+  }
+}
+
+} // namespace disparity_image_proc
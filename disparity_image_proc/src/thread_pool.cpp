@@ -0,0 +1,119 @@
+#include <disparity_image_proc/thread_pool.h>
+
+#include <algorithm>
+#include <atomic>
+
+namespace disparity_image_proc
+{
+
+struct ThreadPool::Job
+{
+  const std::function<void(int, int)>* function;
+  int count;
+  int band_size;
+  int number_of_bands;
+  std::atomic<int> next_band;
+  std::atomic<int> remaining_bands;
+};
+
+ThreadPool::ThreadPool(int number_of_threads) : _job_id(0), _stop(false)
+{
+  // The calling thread of parallelFor() is one of the threads
+  for (int i = 1; i < number_of_threads; i++)
+    _workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _job_condition.notify_all();
+
+  for (std::thread& worker : _workers)
+    worker.join();
+}
+
+int ThreadPool::getNumberOfThreads() const
+{
+  return _workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int, int)>& function)
+{
+  if (count <= 0)
+    return;
+
+  if (_workers.empty())
+  {
+    function(0, count);
+    return;
+  }
+
+  std::lock_guard<std::mutex> call_lock(_call_mutex);
+
+  // Several bands per thread to balance rows with different number of valid pixels
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->function = &function;
+  job->count = count;
+  job->number_of_bands = std::min(count, getNumberOfThreads() * 4);
+  job->band_size = (count + job->number_of_bands - 1) / job->number_of_bands;
+  job->number_of_bands = (count + job->band_size - 1) / job->band_size;
+  job->next_band = 0;
+  job->remaining_bands = job->number_of_bands;
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _job = job;
+    _job_id++;
+  }
+  _job_condition.notify_all();
+
+  processBands(*job);
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _finish_condition.wait(lock, [&job] { return job->remaining_bands == 0; });
+  _job.reset();
+}
+
+void ThreadPool::processBands(Job& job)
+{
+  int band;
+  while ((band = job.next_band++) < job.number_of_bands)
+  {
+    int begin = band * job.band_size;
+    int end = std::min(begin + job.band_size, job.count);
+    (*job.function)(begin, end);
+
+    if (--job.remaining_bands == 0)
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _finish_condition.notify_all();
+    }
+  }
+}
+
+void ThreadPool::workerLoop()
+{
+  uint64_t processed_job_id = 0;
+  while (true)
+  {
+    std::shared_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _job_condition.wait(lock, [this, processed_job_id] { return _stop || _job_id != processed_job_id; });
+      if (_stop)
+        return;
+
+      processed_job_id = _job_id;
+      job = _job;
+    }
+
+    // The job may be finished already if this thread woke up late
+    if (job)
+      processBands(*job);
+  }
+}
+
+} // namespace disparity_image_proc
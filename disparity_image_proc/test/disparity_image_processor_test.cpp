@@ -0,0 +1,468 @@
+#include <disparity_image_proc/disparity_image_processor.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Every reprojection path of DisparityImageProcessor is compared with getPoint3D(),
+// and getPoint3D() is compared with depth divided by disparity.
+//
+// Widths which aren't multiple of 8 leave tails of rows to scalar code after SIMD blocks.
+// Build with -DDISPARITY_IMAGE_PROC_USE_AVX=ON or -DDISPARITY_IMAGE_PROC_USE_AVX2=ON to check the other kernels.
+
+namespace
+{
+
+const float FOCAL_LENGTH = 500.0f;
+const float BASELINE = 0.1f;
+const float MIN_DISPARITY = 1.0f;
+const float MAX_DISPARITY = 64.0f;
+const int FRACTIONAL_BITS = 4;
+const float DISPARITY_STEP = 1.0f / (1 << FRACTIONAL_BITS);
+const int HEIGHT = 5;
+
+sensor_msgs::CameraInfoPtr makeCameraInfo(int width, int height)
+{
+  // Principal point off the center makes x and y of points differ between pixels
+  double cx = width / 2.0 - 0.3;
+  double cy = height / 2.0 + 0.2;
+  sensor_msgs::CameraInfoPtr camera_info(new sensor_msgs::CameraInfo());
+  camera_info->width = width;
+  camera_info->height = height;
+  camera_info->K = {FOCAL_LENGTH, 0.0, cx, 0.0, FOCAL_LENGTH, cy, 0.0, 0.0, 1.0};
+  camera_info->R = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  camera_info->P = {FOCAL_LENGTH, 0.0, cx, 0.0, 0.0, FOCAL_LENGTH, cy, 0.0, 0.0, 0.0, 1.0, 0.0};
+  return camera_info;
+}
+
+/**
+ * \brief Disparity containing NaN, infinity, zero, negative, edges of the range, off-step and on-step values
+ */
+stereo_msgs::DisparityImagePtr makeDisparity(int width, int height)
+{
+  const float special_values[] = {
+    std::numeric_limits<float>::quiet_NaN(),
+    std::numeric_limits<float>::infinity(),
+    -std::numeric_limits<float>::infinity(),
+    0.0f,
+    -1.0f,
+    MIN_DISPARITY,
+    MIN_DISPARITY - DISPARITY_STEP,
+    MAX_DISPARITY,
+    MAX_DISPARITY + DISPARITY_STEP,
+    MAX_DISPARITY + 0.01f,
+    10.03f,
+    MIN_DISPARITY + 0.001f,
+  };
+  const int number_of_special_values = sizeof(special_values) / sizeof(special_values[0]);
+
+  stereo_msgs::DisparityImagePtr disparity(new stereo_msgs::DisparityImage());
+  disparity->f = FOCAL_LENGTH;
+  disparity->T = BASELINE;
+  disparity->min_disparity = MIN_DISPARITY;
+  disparity->max_disparity = MAX_DISPARITY;
+  disparity->delta_d = DISPARITY_STEP;
+  disparity->image.width = width;
+  disparity->image.height = height;
+  disparity->image.encoding = "32FC1";
+  disparity->image.step = width * sizeof(float);
+  disparity->image.data.resize(disparity->image.step * height);
+
+  // Special values are mixed with valid values on quantization steps at random pixels
+  std::mt19937 random_engine(width);
+  std::uniform_int_distribution<int> kind(0, 2 * number_of_special_values - 1);
+  std::uniform_int_distribution<int> step(MIN_DISPARITY * (1 << FRACTIONAL_BITS), MAX_DISPARITY * (1 << FRACTIONAL_BITS));
+
+  float* data = reinterpret_cast<float*>(disparity->image.data.data());
+  for (int i = 0; i < width * height; i++)
+  {
+    int k = kind(random_engine);
+    data[i] = k < number_of_special_values ? special_values[k] : step(random_engine) * DISPARITY_STEP;
+  }
+  return disparity;
+}
+
+/**
+ * \brief Fixed-point disparity like SGM output. Values which can't be represented are -1 step.
+ */
+cv::Mat toFixedPoint(const stereo_msgs::DisparityImage& disparity)
+{
+  cv::Mat fixed_point(disparity.image.height, disparity.image.width, CV_16SC1);
+  const float* data = reinterpret_cast<const float*>(disparity.image.data.data());
+  for (int i = 0; i < fixed_point.rows * fixed_point.cols; i++)
+  {
+    float value = data[i] * (1 << FRACTIONAL_BITS);
+    int16_t fixed_point_value = -1;
+    if (std::isfinite(value) && std::abs(value) < std::numeric_limits<int16_t>::max())
+      fixed_point_value = static_cast<int16_t>(std::round(value));
+    fixed_point.at<int16_t>(i / fixed_point.cols, i % fixed_point.cols) = fixed_point_value;
+  }
+  return fixed_point;
+}
+
+enum class Mode
+{
+  FLOAT_DEFAULT,
+  FLOAT_WITH_DEPTH_TABLE,
+  FLOAT_WITHOUT_DEPTH_TABLE,
+  FIXED_POINT
+};
+
+struct TestParam
+{
+  int width;
+  Mode mode;
+};
+
+std::string paramName(const testing::TestParamInfo<TestParam>& info)
+{
+  const char* mode_names[] = {"FloatDefault", "FloatWithDepthTable", "FloatWithoutDepthTable", "FixedPoint"};
+  return std::string(mode_names[static_cast<int>(info.param.mode)]) + "Width" + std::to_string(info.param.width);
+}
+
+void expectSamePoint(const pcl::PointXYZ& actual, const pcl::PointXYZ& expected, bool expected_valid)
+{
+  if (!expected_valid)
+  {
+    EXPECT_TRUE(std::isnan(actual.x));
+    EXPECT_TRUE(std::isnan(actual.y));
+    EXPECT_TRUE(std::isnan(actual.z));
+    return;
+  }
+  EXPECT_FLOAT_EQ(expected.x, actual.x);
+  EXPECT_FLOAT_EQ(expected.y, actual.y);
+  EXPECT_FLOAT_EQ(expected.z, actual.z);
+}
+
+class DisparityImageProcessorTest : public testing::TestWithParam<TestParam>
+{
+protected:
+  void SetUp() override
+  {
+    width_ = GetParam().width;
+    camera_info_ = makeCameraInfo(width_, HEIGHT);
+    disparity_msg_ = makeDisparity(width_, HEIGHT);
+    camera_model_.fromCameraInfo(camera_info_);
+
+    switch (GetParam().mode)
+    {
+    case Mode::FLOAT_DEFAULT:
+      processor_ = std::make_shared<DisparityImageProcessor>(disparity_msg_, camera_info_);
+      break;
+    case Mode::FLOAT_WITH_DEPTH_TABLE:
+      processor_ = std::make_shared<DisparityImageProcessor>(disparity_msg_, camera_info_);
+      processor_->setDisparityStep(DISPARITY_STEP);
+      break;
+    case Mode::FLOAT_WITHOUT_DEPTH_TABLE:
+      processor_ = std::make_shared<DisparityImageProcessor>(disparity_msg_, camera_info_);
+      processor_->setDisparityStep(0.0f);
+      break;
+    case Mode::FIXED_POINT:
+      processor_ = std::make_shared<DisparityImageProcessor>(disparity_msg_, toFixedPoint(*disparity_msg_), FRACTIONAL_BITS, camera_info_);
+      break;
+    }
+
+    // Expected disparity and validity, computed independently of the processor
+    cv::Mat fixed_point = toFixedPoint(*disparity_msg_);
+    const float* data = reinterpret_cast<const float*>(disparity_msg_->image.data.data());
+    expected_disparity_.resize(width_ * HEIGHT);
+    expected_valid_.resize(width_ * HEIGHT);
+    for (int i = 0; i < width_ * HEIGHT; i++)
+    {
+      float disparity = data[i];
+      if (GetParam().mode == Mode::FIXED_POINT)
+        disparity = fixed_point.at<int16_t>(i / width_, i % width_) * DISPARITY_STEP;
+      expected_disparity_[i] = disparity;
+      expected_valid_[i] = disparity >= MIN_DISPARITY && disparity <= MAX_DISPARITY && disparity != 0.0f;
+    }
+  }
+
+  bool expectedValid(int u, int v)
+  {
+    return expected_valid_[v * width_ + u];
+  }
+
+  pcl::PointXYZ referencePoint(int u, int v)
+  {
+    pcl::PointXYZ point(std::nanf(""), std::nanf(""), std::nanf(""));
+    processor_->getPoint3D(u, v, point);
+    return point;
+  }
+
+  int width_;
+  sensor_msgs::CameraInfoPtr camera_info_;
+  stereo_msgs::DisparityImagePtr disparity_msg_;
+  image_geometry::PinholeCameraModel camera_model_;
+  std::shared_ptr<DisparityImageProcessor> processor_;
+  std::vector<float> expected_disparity_;
+  std::vector<bool> expected_valid_;
+};
+
+TEST_P(DisparityImageProcessorTest, GetPoint3DMatchesDivision)
+{
+  for (int v = 0; v < HEIGHT; v++)
+  {
+    for (int u = 0; u < width_; u++)
+    {
+      SCOPED_TRACE("u = " + std::to_string(u) + ", v = " + std::to_string(v));
+      pcl::PointXYZ point;
+      bool valid = processor_->getPoint3D(u, v, point);
+      ASSERT_EQ(expectedValid(u, v), valid);
+      if (!valid)
+        continue;
+
+      float z = FOCAL_LENGTH * BASELINE / expected_disparity_[v * width_ + u];
+      cv::Point3d ray = camera_model_.projectPixelTo3dRay(cv::Point2d(u, v));
+      EXPECT_NEAR(z, point.z, 1e-5 * z);
+      EXPECT_NEAR(ray.x * z, point.x, 1e-5 * z);
+      EXPECT_NEAR(ray.y * z, point.y, 1e-5 * z);
+    }
+  }
+}
+
+TEST_P(DisparityImageProcessorTest, ValidityMaskMatchesReference)
+{
+  int stride = processor_->getValidityMaskStride();
+  ASSERT_EQ((width_ + 63) / 64, stride);
+
+  std::vector<int> expected_pixels;
+  for (int v = 0; v < HEIGHT; v++)
+  {
+    const uint64_t* mask_row = processor_->getValidityMaskRow(v);
+    for (int u = 0; u < stride * 64; u++)
+    {
+      bool bit = (mask_row[u / 64] >> (u % 64)) & 1;
+      if (u >= width_)
+      {
+        // Bits after the end of the row are cleared
+        EXPECT_FALSE(bit) << "u = " << u << ", v = " << v;
+        continue;
+      }
+      EXPECT_EQ(expectedValid(u, v), bit) << "u = " << u << ", v = " << v;
+      EXPECT_EQ(expectedValid(u, v), processor_->isValidPixel(u, v)) << "u = " << u << ", v = " << v;
+      if (expectedValid(u, v))
+        expected_pixels.push_back(v * width_ + u);
+    }
+  }
+
+  // Pixels out of image are invalid
+  EXPECT_FALSE(processor_->isValidPixel(-1, 0));
+  EXPECT_FALSE(processor_->isValidPixel(width_, 0));
+  EXPECT_FALSE(processor_->isValidPixel(0, -1));
+  EXPECT_FALSE(processor_->isValidPixel(0, HEIGHT));
+
+  std::vector<int> visited_pixels;
+  processor_->forEachValidPixel([&](int u, int v) { visited_pixels.push_back(v * width_ + u); });
+  EXPECT_EQ(expected_pixels, visited_pixels);
+}
+
+TEST_P(DisparityImageProcessorTest, OrganizedOutputsMatchGetPoint3D)
+{
+  pcl::PointCloud<pcl::PointXYZ> pointcloud, parallel_pointcloud, fused_pointcloud, parallel_fused_pointcloud;
+  cv::Mat depth_image, fused_depth_image, parallel_fused_depth_image, valid_mask, parallel_valid_mask;
+  disparity_image_proc::ThreadPool thread_pool(3);
+
+  processor_->toPointCloud(pointcloud);
+  processor_->toPointCloud(parallel_pointcloud, thread_pool);
+  processor_->toDepthImage(depth_image);
+  processor_->toPointCloudAndDepthImage(fused_pointcloud, fused_depth_image, &valid_mask);
+  processor_->toPointCloudAndDepthImage(parallel_fused_pointcloud, parallel_fused_depth_image, thread_pool, &parallel_valid_mask);
+
+  for (pcl::PointCloud<pcl::PointXYZ>* cloud : {&pointcloud, &parallel_pointcloud, &fused_pointcloud, &parallel_fused_pointcloud})
+  {
+    ASSERT_EQ(static_cast<uint32_t>(width_), cloud->width);
+    ASSERT_EQ(static_cast<uint32_t>(HEIGHT), cloud->height);
+  }
+
+  for (int v = 0; v < HEIGHT; v++)
+  {
+    for (int u = 0; u < width_; u++)
+    {
+      SCOPED_TRACE("u = " + std::to_string(u) + ", v = " + std::to_string(v));
+      bool valid = expectedValid(u, v);
+      pcl::PointXYZ expected = referencePoint(u, v);
+
+      expectSamePoint(pointcloud.at(u, v), expected, valid);
+      expectSamePoint(parallel_pointcloud.at(u, v), expected, valid);
+      expectSamePoint(fused_pointcloud.at(u, v), expected, valid);
+      expectSamePoint(parallel_fused_pointcloud.at(u, v), expected, valid);
+
+      for (const cv::Mat* depth : {&depth_image, &fused_depth_image, &parallel_fused_depth_image})
+      {
+        if (valid)
+          EXPECT_FLOAT_EQ(expected.z, depth->at<float>(v, u));
+        else
+          EXPECT_TRUE(std::isnan(depth->at<float>(v, u)));
+      }
+      EXPECT_EQ(valid ? 255 : 0, valid_mask.at<unsigned char>(v, u));
+      EXPECT_EQ(valid ? 255 : 0, parallel_valid_mask.at<unsigned char>(v, u));
+    }
+  }
+}
+
+TEST_P(DisparityImageProcessorTest, RestrictedOutputsMatchGetPoint3D)
+{
+  // Runs of selected pixels start and end at various columns
+  cv::Mat mask(HEIGHT, width_, CV_8UC1);
+  for (int v = 0; v < HEIGHT; v++)
+  {
+    for (int u = 0; u < width_; u++)
+      mask.at<unsigned char>(v, u) = ((u / (v + 2)) % 2 == 0) ? 255 : 0;
+  }
+  std::vector<cv::Rect> rois = {cv::Rect(1, 1, width_ / 2 + 1, 2), cv::Rect(width_ / 3, 0, width_, HEIGHT + 3)};
+  std::vector<int> pixel_indices;
+  for (int i = 0; i < width_ * HEIGHT; i += 3)
+    pixel_indices.push_back(i);
+
+  pcl::PointCloud<pcl::PointXYZ> masked_pointcloud, roi_pointcloud;
+  processor_->toPointCloud(mask, masked_pointcloud);
+  processor_->toPointCloud(rois, roi_pointcloud);
+
+  std::vector<int> expected_mask_indices, expected_roi_indices, expected_pixel_indices;
+  cv::Rect image_rect(0, 0, width_, HEIGHT);
+  for (int v = 0; v < HEIGHT; v++)
+  {
+    for (int u = 0; u < width_; u++)
+    {
+      SCOPED_TRACE("u = " + std::to_string(u) + ", v = " + std::to_string(v));
+      bool valid = expectedValid(u, v);
+      pcl::PointXYZ expected = referencePoint(u, v);
+
+      bool selected = mask.at<unsigned char>(v, u) != 0;
+      expectSamePoint(masked_pointcloud.at(u, v), expected, valid && selected);
+      if (valid && selected)
+        expected_mask_indices.push_back(v * width_ + u);
+
+      bool in_roi = false;
+      for (const cv::Rect& roi : rois)
+        in_roi = in_roi || (roi & image_rect).contains(cv::Point(u, v));
+      expectSamePoint(roi_pointcloud.at(u, v), expected, valid && in_roi);
+    }
+  }
+  // Indexed pointcloud of regions contains pixels once per region
+  for (const cv::Rect& roi : rois)
+  {
+    cv::Rect clipped = roi & image_rect;
+    for (int v = clipped.y; v < clipped.y + clipped.height; v++)
+    {
+      for (int u = clipped.x; u < clipped.x + clipped.width; u++)
+      {
+        if (expectedValid(u, v))
+          expected_roi_indices.push_back(v * width_ + u);
+      }
+    }
+  }
+  for (int pixel_index : pixel_indices)
+  {
+    if (expected_valid_[pixel_index])
+      expected_pixel_indices.push_back(pixel_index);
+  }
+
+  pcl::PointCloud<pcl::PointXYZ> indexed_pointcloud;
+  std::vector<int> indices;
+  auto expect_indexed = [&](const std::vector<int>& expected_indices)
+  {
+    ASSERT_EQ(expected_indices, indices);
+    ASSERT_EQ(indices.size(), indexed_pointcloud.size());
+    for (size_t i = 0; i < indices.size(); i++)
+      expectSamePoint(indexed_pointcloud.points[i], referencePoint(indices[i] % width_, indices[i] / width_), true);
+  };
+
+  processor_->toIndexedPointCloud(mask, indexed_pointcloud, indices);
+  expect_indexed(expected_mask_indices);
+  processor_->toIndexedPointCloud(rois, indexed_pointcloud, indices);
+  expect_indexed(expected_roi_indices);
+  processor_->toIndexedPointCloud(pixel_indices, indexed_pointcloud, indices);
+  expect_indexed(expected_pixel_indices);
+}
+
+TEST_P(DisparityImageProcessorTest, DecimatedOutputsMatchGetPoint3D)
+{
+  for (int decimation : {1, 2, 3})
+  {
+    SCOPED_TRACE("decimation = " + std::to_string(decimation));
+    int width = width_ / decimation;
+    int height = HEIGHT / decimation;
+
+    // Sampled block is the top-left pixel reprojected through its own ray
+    pcl::PointCloud<pcl::PointXYZ> sampled;
+    processor_->toPointCloud(sampled, decimation, DisparityImageProcessor::DecimationMethod::SAMPLE);
+    ASSERT_EQ(static_cast<uint32_t>(width), sampled.width);
+    ASSERT_EQ(static_cast<uint32_t>(height), sampled.height);
+    for (int v_block = 0; v_block < height; v_block++)
+    {
+      for (int u_block = 0; u_block < width; u_block++)
+      {
+        int u = u_block * decimation;
+        int v = v_block * decimation;
+        expectSamePoint(sampled.at(u_block, v_block), referencePoint(u, v), expectedValid(u, v));
+      }
+    }
+
+    // Median block is valid if any pixel in it is valid, and its depth is depth of one of them
+    pcl::PointCloud<pcl::PointXYZ> median;
+    processor_->toPointCloud(median, decimation, DisparityImageProcessor::DecimationMethod::MEDIAN);
+    ASSERT_EQ(static_cast<uint32_t>(width), median.width);
+    ASSERT_EQ(static_cast<uint32_t>(height), median.height);
+    for (int v_block = 0; v_block < height; v_block++)
+    {
+      for (int u_block = 0; u_block < width; u_block++)
+      {
+        bool any_valid = false;
+        bool depth_found = false;
+        const pcl::PointXYZ& point = median.at(u_block, v_block);
+        for (int v = v_block * decimation; v < (v_block + 1) * decimation; v++)
+        {
+          for (int u = u_block * decimation; u < (u_block + 1) * decimation; u++)
+          {
+            if (!expectedValid(u, v))
+              continue;
+            any_valid = true;
+            depth_found = depth_found || referencePoint(u, v).z == point.z;
+          }
+        }
+        EXPECT_EQ(any_valid, !std::isnan(point.z)) << "u_block = " << u_block << ", v_block = " << v_block;
+        if (any_valid)
+          EXPECT_TRUE(depth_found) << "u_block = " << u_block << ", v_block = " << v_block;
+      }
+    }
+  }
+}
+
+std::vector<TestParam> testParams()
+{
+  std::vector<TestParam> params;
+  for (Mode mode : {Mode::FLOAT_DEFAULT, Mode::FLOAT_WITH_DEPTH_TABLE, Mode::FLOAT_WITHOUT_DEPTH_TABLE, Mode::FIXED_POINT})
+  {
+    for (int width : {1, 7, 8, 13, 37, 64, 101, 130})
+      params.push_back(TestParam{width, mode});
+  }
+  return params;
+}
+
+INSTANTIATE_TEST_CASE_P(Paths, DisparityImageProcessorTest, testing::ValuesIn(testParams()), paramName);
+
+TEST(DisparityImageProcessorFixedPoint, RejectsFractionalBitsOutOfRange)
+{
+  sensor_msgs::CameraInfoPtr camera_info = makeCameraInfo(8, HEIGHT);
+  stereo_msgs::DisparityImagePtr disparity_msg = makeDisparity(8, HEIGHT);
+  cv::Mat fixed_point = toFixedPoint(*disparity_msg);
+
+  EXPECT_THROW(DisparityImageProcessor(disparity_msg, fixed_point, -1, camera_info), std::invalid_argument);
+  EXPECT_THROW(DisparityImageProcessor(disparity_msg, fixed_point, 9, camera_info), std::invalid_argument);
+  EXPECT_NO_THROW(DisparityImageProcessor(disparity_msg, fixed_point, 0, camera_info));
+  EXPECT_NO_THROW(DisparityImageProcessor(disparity_msg, fixed_point, 8, camera_info));
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
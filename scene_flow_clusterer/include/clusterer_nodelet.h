@@ -3,6 +3,7 @@
 
 #include <scene_flow_clusterer/ClustererConfig.h>
 #include <moving_object_msgs/MovingObjectArray.h>
+#include <moving_object_msgs/SparseSceneFlow.h>
 
 #define PCL_NO_PRECOMPILE
 
@@ -80,11 +81,19 @@ private:
   };
   void comparePoints(const Point2d &insterest_point, const Point2d &compared_point);
   void dataCB(const sensor_msgs::PointCloud2ConstPtr &velocity_pc_msg);
+  /**
+   * \brief Scatter sparse scene flow to organized input_pointcloud_ and process it same as dataCB()
+   */
+  void sparseDataCB(const moving_object_msgs::SparseSceneFlowConstPtr &sparse_msg);
   inline float depthDiff(const Point2d &point1, const Point2d &point2)
   {
     return std::abs(point3dAt(point1).z - point3dAt(point2).z);
   };
   void initClusterMap();
+  /**
+   * \brief Cluster input_pointcloud_ and publish results
+   */
+  void processInput(const std_msgs::Header &header);
   void integrateConnectedClusters();
   inline bool isDynamic(const Point2d &point)
   {
@@ -32,7 +32,13 @@ void ClustererNodelet::onInit()
   image_transport_ = std::make_shared<image_transport::ImageTransport>(private_node_handle);
   clusters_image_pub_ = image_transport_->advertise("clusters_image", 1);
   
-  velocity_pc_sub_ = node_handle.subscribe<sensor_msgs::PointCloud2>("scene_flow", 10, &ClustererNodelet::dataCB, this);
+  // Sparse scene flow contains only dynamic points, so it's much smaller than organized pointcloud
+  bool use_sparse_scene_flow;
+  private_node_handle.param("use_sparse_scene_flow", use_sparse_scene_flow, false);
+  if (use_sparse_scene_flow)
+    velocity_pc_sub_ = node_handle.subscribe<moving_object_msgs::SparseSceneFlow>("sparse_scene_flow", 10, &ClustererNodelet::sparseDataCB, this);
+  else
+    velocity_pc_sub_ = node_handle.subscribe<sensor_msgs::PointCloud2>("scene_flow", 10, &ClustererNodelet::dataCB, this);
   dynamic_objects_pub_ = private_node_handle.advertise<moving_object_msgs::MovingObjectArray>("moving_objects", 1);
   clusters_pub_ = private_node_handle.advertise<visualization_msgs::MarkerArray>("clusters", 1);
 }
@@ -225,7 +231,51 @@ void ClustererNodelet::dataCB(const sensor_msgs::PointCloud2ConstPtr& input_pc_m
   input_pointcloud_ = pcl::PointCloud<pcl::PointXYZVelocity>::Ptr(new pcl::PointCloud<pcl::PointXYZVelocity>);
   pcl::fromROSMsg(*input_pc_msg, *input_pointcloud_);
 
-  input_header_ = input_pc_msg->header;
+  processInput(input_pc_msg->header);
+
+  ros::Duration process_time = ros::Time::now() - start;
+  NODELET_INFO_STREAM("Process time: " << process_time.toSec() << " [s]");
+}
+
+void ClustererNodelet::sparseDataCB(const moving_object_msgs::SparseSceneFlowConstPtr &sparse_msg)
+{
+  ros::Time start = ros::Time::now();
+
+  pcl::PointCloud<pcl::PointXYZVelocity> sparse_points;
+  pcl::fromROSMsg(sparse_msg->points, sparse_points);
+  if (sparse_points.size() != sparse_msg->pixel_indices.size())
+  {
+    NODELET_ERROR_STREAM("Number of points and pixel indices of sparse scene flow are different: " << sparse_points.size() << " and " << sparse_msg->pixel_indices.size());
+    return;
+  }
+
+  // Pixels not contained in the message are treated as static
+  pcl::PointXYZVelocity static_point;
+  static_point.x = static_point.y = static_point.z = std::nanf("");
+  static_point.vx = static_point.vy = static_point.vz = 0.0f;
+  input_pointcloud_ = pcl::PointCloud<pcl::PointXYZVelocity>::Ptr(new pcl::PointCloud<pcl::PointXYZVelocity>(sparse_msg->width, sparse_msg->height, static_point));
+  input_pointcloud_->is_dense = false;
+
+  for (size_t i = 0; i < sparse_points.size(); i++)
+  {
+    uint32_t pixel_index = sparse_msg->pixel_indices[i];
+    if (pixel_index >= input_pointcloud_->size())
+    {
+      NODELET_ERROR_STREAM("Pixel index " << pixel_index << " of sparse scene flow is out of image");
+      return;
+    }
+    input_pointcloud_->at(pixel_index) = sparse_points.at(i);
+  }
+
+  processInput(sparse_msg->header);
+
+  ros::Duration process_time = ros::Time::now() - start;
+  NODELET_INFO_STREAM("Process time: " << process_time.toSec() << " [s]");
+}
+
+void ClustererNodelet::processInput(const std_msgs::Header &header)
+{
+  input_header_ = header;
 
   pcl::IndicesClusters clusters;
   clustering(clusters);
@@ -236,9 +286,6 @@ void ClustererNodelet::dataCB(const sensor_msgs::PointCloud2ConstPtr& input_pc_m
     publishClustersImage();
   if (dynamic_objects_pub_.getNumSubscribers() > 0)
     publishMovingObjects(clusters);
-
-  ros::Duration process_time = ros::Time::now() - start;
-  NODELET_INFO_STREAM("Process time: " << process_time.toSec() << " [s]");
 }
 
 void ClustererNodelet::initClusterMap()
@@ -0,0 +1,140 @@
+#include "sgbm_disparity_estimator.h"
+
+#include <disparity_image_proc/benchmark_helpers.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/image_encodings.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// Throughput of CPU disparity estimation on synthetic stereo pairs.
+//
+// Arguments of each benchmark are (width, height, number of disparities).
+// Left image is right image warped by a slanted plane disparity,
+// so accuracy is also reported against the ground truth.
+
+namespace
+{
+
+using namespace disparity_image_proc::benchmark_helpers;
+
+/**
+ * \brief Ground truth disparity, leaving a margin to the search range of SGBM
+ */
+cv::Mat makeGroundTruth(int width, int height, int num_disparities)
+{
+  cv::Mat disparity(height, width, CV_32FC1);
+  for (int v = 0; v < height; v++)
+  {
+    for (int u = 0; u < width; u++)
+      disparity.at<float>(v, u) = groundTruthDisparity(u, v, height, num_disparities * 0.8f);
+  }
+  return disparity;
+}
+
+void makeStereoPair(const cv::Mat& disparity, cv::Mat& left, cv::Mat& right)
+{
+  // Blurred noise gives texture which every block can be matched with
+  right.create(disparity.size(), CV_8UC1);
+  cv::RNG rng(0);
+  rng.fill(right, cv::RNG::UNIFORM, 0, 256);
+  cv::GaussianBlur(right, right, cv::Size(3, 3), 0.8);
+
+  cv::Mat map_x(disparity.size(), CV_32FC1), map_y(disparity.size(), CV_32FC1);
+  for (int v = 0; v < disparity.rows; v++)
+  {
+    for (int u = 0; u < disparity.cols; u++)
+    {
+      map_x.at<float>(v, u) = u - disparity.at<float>(v, u);
+      map_y.at<float>(v, u) = v;
+    }
+  }
+  cv::remap(right, left, map_x, map_y, cv::INTER_LINEAR, cv::BORDER_REFLECT);
+}
+
+/**
+ * \brief Mean absolute error of valid pixels and ratio of valid pixels in the valid window
+ */
+void evaluate(const stereo_msgs::DisparityImage& disparity_msg, const cv::Mat& ground_truth, double& mean_error, double& valid_ratio)
+{
+  cv_bridge::CvImageConstPtr estimated = cv_bridge::toCvCopy(disparity_msg.image);
+  const sensor_msgs::RegionOfInterest& window = disparity_msg.valid_window;
+
+  double error_sum = 0.0;
+  int valid = 0;
+  int total = 0;
+  for (int v = window.y_offset; v < static_cast<int>(window.y_offset + window.height); v++)
+  {
+    for (int u = window.x_offset; u < static_cast<int>(window.x_offset + window.width); u++)
+    {
+      total++;
+      float value = estimated->image.at<float>(v, u);
+      if (value < disparity_msg.min_disparity || value > disparity_msg.max_disparity)
+        continue;
+      error_sum += std::fabs(value - ground_truth.at<float>(v, u));
+      valid++;
+    }
+  }
+  mean_error = valid > 0 ? error_sum / valid : INFINITY;
+  valid_ratio = total > 0 ? static_cast<double>(valid) / total : 0.0;
+}
+
+void resolutions(benchmark::internal::Benchmark* benchmark)
+{
+  applyResolutions(benchmark, {64, 128});
+  benchmark->Unit(benchmark::kMillisecond);
+  benchmark->UseRealTime();
+}
+
+} // namespace
+
+static void BM_SgbmDisparityEstimator(benchmark::State& state)
+{
+  int width = state.range(0);
+  int height = state.range(1);
+  int num_disparities = state.range(2);
+
+  cv::Mat ground_truth = makeGroundTruth(width, height, num_disparities);
+  cv::Mat left, right;
+  makeStereoPair(ground_truth, left, right);
+
+  std_msgs::Header header;
+  header.frame_id = "camera";
+  sensor_msgs::ImagePtr left_msg = cv_bridge::CvImage(header, sensor_msgs::image_encodings::MONO8, left).toImageMsg();
+  sensor_msgs::ImagePtr right_msg = cv_bridge::CvImage(header, sensor_msgs::image_encodings::MONO8, right).toImageMsg();
+  sensor_msgs::CameraInfo left_info = makeCameraInfo(width, height, 0.0);
+  sensor_msgs::CameraInfo right_info = makeCameraInfo(width, height, -FOCAL_LENGTH * BASELINE);
+
+  scene_flow_constructor::SgbmDisparityEstimator::Parameters parameters;
+  parameters.num_disparities = num_disparities;
+  scene_flow_constructor::SgbmDisparityEstimator estimator(parameters);
+
+  // Input is already mono, so it's shared without conversion like in the node
+  scene_flow_constructor::MonoImage left_image(left_msg);
+  scene_flow_constructor::MonoImage right_image(right_msg);
+
+  stereo_msgs::DisparityImage disparity;
+  for (auto _ : state)
+  {
+    if (!estimator.estimate(left_image, right_image, left_info, right_info, disparity))
+    {
+      state.SkipWithError("Disparity estimation is failed");
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["fps"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+
+  double mean_error, valid_ratio;
+  evaluate(disparity, ground_truth, mean_error, valid_ratio);
+  state.counters["mean_error_px"] = mean_error;
+  state.counters["valid_ratio"] = valid_ratio;
+}
+BENCHMARK(BM_SgbmDisparityEstimator)->Apply(resolutions);
+
+BENCHMARK_MAIN();
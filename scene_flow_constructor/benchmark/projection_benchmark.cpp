@@ -0,0 +1,93 @@
+#include "projection_kernel.h"
+
+#include <disparity_image_proc/benchmark_helpers.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// Compare time of projection of calculateStaticOpticalFlow() by image_geometry in double precision
+// and by projectStaticFlow() in single precision. Their output is compared by projection_kernel_test.
+//
+// Arguments of each benchmark are (width, height, percentage of invalid points).
+
+namespace
+{
+
+using namespace disparity_image_proc::benchmark_helpers;
+
+/**
+ * \brief Same as calculateStaticOpticalFlow() before vectorization
+ */
+void projectByImageGeometry(const image_geometry::PinholeCameraModel& camera_model, const std::vector<float>& points, int width, int height, cv::Mat& flow)
+{
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      const float* point = &points[4 * (y * width + x)];
+      if (std::isnan(point[0]))
+      {
+        flow.at<cv::Vec2f>(y, x) = cv::Vec2f(std::nanf(""), std::nanf(""));
+        continue;
+      }
+
+      cv::Point2d point_2d = camera_model.project3dToPixel(cv::Point3d(point[0], point[1], point[2]));
+      flow.at<cv::Vec2f>(y, x) = cv::Vec2f(point_2d.x - x, point_2d.y - y);
+    }
+  }
+}
+
+void projectBySimd(const scene_flow_constructor::ProjectionParams& params, const std::vector<float>& points, int width, int height, cv::Mat& flow)
+{
+  for (int y = 0; y < height; y++)
+    scene_flow_constructor::projectStaticFlow(&points[4 * y * width], width, 0, y, params, flow.ptr<float>(y));
+}
+
+void resolutions(benchmark::internal::Benchmark* benchmark)
+{
+  applyResolutions(benchmark, {0, 30, 50});
+  benchmark->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+static void BM_ProjectByImageGeometry(benchmark::State& state)
+{
+  int width = state.range(0);
+  int height = state.range(1);
+  image_geometry::PinholeCameraModel camera_model = makeCameraModel(width, height);
+  std::vector<float> points = makePoints(camera_model, width, height, state.range(2));
+  cv::Mat flow(height, width, CV_32FC2);
+
+  for (auto _ : state)
+  {
+    projectByImageGeometry(camera_model, points, width, height, flow);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * width * height);
+}
+BENCHMARK(BM_ProjectByImageGeometry)->Apply(resolutions);
+
+static void BM_ProjectBySimd(benchmark::State& state)
+{
+  int width = state.range(0);
+  int height = state.range(1);
+  image_geometry::PinholeCameraModel camera_model = makeCameraModel(width, height);
+  scene_flow_constructor::ProjectionParams params(camera_model);
+  std::vector<float> points = makePoints(camera_model, width, height, state.range(2));
+  cv::Mat flow(height, width, CV_32FC2);
+
+  for (auto _ : state)
+  {
+    projectBySimd(params, points, width, height, flow);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * width * height);
+}
+BENCHMARK(BM_ProjectBySimd)->Apply(resolutions);
+
+BENCHMARK_MAIN();
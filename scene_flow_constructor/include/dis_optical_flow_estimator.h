@@ -0,0 +1,77 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__DIS_OPTICAL_FLOW_ESTIMATOR_H_
+#define SCENE_FLOW_CONSTRUCTOR__DIS_OPTICAL_FLOW_ESTIMATOR_H_
+
+#include "optical_flow_estimator.h"
+
+#include <opencv2/core/version.hpp>
+#include <opencv2/video/tracking.hpp>
+
+// DIS optical flow is in video module since OpenCV 4.0, and in optflow module of opencv_contrib before that
+#if CV_VERSION_MAJOR >= 4 || defined(SCENE_FLOW_CONSTRUCTOR_HAVE_OPTFLOW)
+#define SCENE_FLOW_CONSTRUCTOR_HAVE_DIS
+#endif
+
+namespace scene_flow_constructor {
+
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_DIS
+/**
+ * \brief Dense optical flow estimation on CPU
+ *
+ * Uses DIS optical flow (inverse search of patches over an image pyramid) of OpenCV,
+ * which processes patches in parallel.
+ * Built only if OpenCV has DIS optical flow, see SCENE_FLOW_CONSTRUCTOR_HAVE_DIS.
+ */
+class DisOpticalFlowEstimator : public OpticalFlowEstimator {
+public:
+  struct Parameters
+  {
+    /**
+     * \brief "ultrafast", "fast" or "medium", trading accuracy for speed
+     */
+    std::string preset = "fast";
+    /**
+     * \brief Margin[pixel] around each region added as context of estimateInRegions()
+     */
+    int region_padding = 16;
+  };
+
+  explicit DisOpticalFlowEstimator(const Parameters& parameters);
+
+  /**
+   * \brief Load parameters under "dis" namespace of the node handle
+   */
+  static Parameters loadParameters(ros::NodeHandle private_node_handle);
+
+  bool estimate(MonoImage& image_previous, MonoImage& image_now, cv::Mat& flow) override;
+  bool supportsRegions() const override
+  {
+    return true;
+  }
+  /**
+   * \brief Estimate flow of padded crop of each region, so work is proportional to area of the regions
+   */
+  bool estimateInRegions(MonoImage& image_previous, MonoImage& image_now, const std::vector<cv::Rect>& regions, cv::Mat& flow) override;
+
+private:
+  int region_padding_;
+
+  /**
+   * \brief cv::DISOpticalFlow of OpenCV 4, or cv::optflow::DISOpticalFlow of OpenCV 3
+   */
+  cv::Ptr<cv::DenseOpticalFlow> dis_;
+  /**
+   * \brief Flow from image_now to image_previous, reused between frames
+   */
+  cv::Mat backward_flow_;
+
+  bool convertToMono(MonoImage& image_previous, MonoImage& image_now, cv::Mat& mono_previous, cv::Mat& mono_now);
+  /**
+   * \brief Estimate flow at pixels of now, (u, v) - flow is the pixel in previous
+   */
+  void calculateFlow(const cv::Mat& previous, const cv::Mat& now, cv::Mat& flow);
+};
+#endif
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__DIS_OPTICAL_FLOW_ESTIMATOR_H_
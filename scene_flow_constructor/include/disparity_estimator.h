@@ -0,0 +1,70 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__DISPARITY_ESTIMATOR_H_
+#define SCENE_FLOW_CONSTRUCTOR__DISPARITY_ESTIMATOR_H_
+
+#include "mono_image.h"
+
+#include <disparity_image_proc/disparity_image_processor.h>
+#include <ros/ros.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <stereo_msgs/DisparityImage.h>
+
+#include <memory>
+#include <string>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Interface of stereo matcher which estimates disparity of left image
+ */
+class DisparityEstimator {
+public:
+  virtual ~DisparityEstimator() {}
+
+  /**
+   * \param left_image, right_image Input images, whose mono conversion is shared with other stages
+   * \param disparity Output disparity image with 32FC1 encoding. Invalid pixels are out of [min_disparity, max_disparity].
+   * \return false if estimation is failed
+   */
+  virtual bool estimate
+  (
+    MonoImage& left_image,
+    MonoImage& right_image,
+    const sensor_msgs::CameraInfo& left_camera_info,
+    const sensor_msgs::CameraInfo& right_camera_info,
+    stereo_msgs::DisparityImage& disparity
+  ) = 0;
+
+  /**
+   * \brief Estimate disparity and wrap it in a processor
+   *
+   * Default implementation wraps output of estimate().
+   * Backends with fixed-point output override this to hand it to the processor without conversion to float.
+   *
+   * \return nullptr if estimation is failed
+   */
+  virtual std::shared_ptr<DisparityImageProcessor> estimateProcessor
+  (
+    MonoImage& left_image,
+    MonoImage& right_image,
+    const sensor_msgs::CameraInfoConstPtr& left_camera_info,
+    const sensor_msgs::CameraInfoConstPtr& right_camera_info
+  );
+};
+
+/**
+ * \brief Create backend of disparity estimation
+ *
+ * \param type "sgm_gpu" for SGM on GPU, or "sgbm" for semi-global block matching of OpenCV on CPU
+ * \param private_node_handle Node handle to load parameters of the backend
+ * \throw std::invalid_argument if type is unknown, or its backend is not built
+ */
+std::shared_ptr<DisparityEstimator> createDisparityEstimator(const std::string& type, ros::NodeHandle private_node_handle);
+
+/**
+ * \brief Default type of createDisparityEstimator(), "sgm_gpu" if it's built and "sgbm" otherwise
+ */
+std::string defaultDisparityEstimatorType();
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__DISPARITY_ESTIMATOR_H_
@@ -0,0 +1,64 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__FRAME_BUFFER_ARENA_H_
+#define SCENE_FLOW_CONSTRUCTOR__FRAME_BUFFER_ARENA_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Recycling pool of per-frame buffers such as pointclouds and images
+ *
+ * A buffer is free again when the last shared_ptr outside the arena is released,
+ * so buffers of frames in flight or kept as previous frame are never handed out twice.
+ * Recycled buffers keep their memory, and resizing them to the same resolution doesn't allocate,
+ * so steady-state processing doesn't touch the heap.
+ * Free buffers are discarded when the requested resolution changes.
+ */
+template <typename T>
+class FrameBufferArena {
+public:
+  FrameBufferArena() : width_(0), height_(0) {}
+
+  FrameBufferArena(const FrameBufferArena&) = delete;
+  FrameBufferArena& operator=(const FrameBufferArena&) = delete;
+
+  /**
+   * \brief Get a buffer for a frame of the resolution
+   *
+   * Contents of the buffer are left from the previous use, so callers have to resize and overwrite it.
+   */
+  std::shared_ptr<T> acquire(int width, int height)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (width != width_ || height != height_)
+    {
+      // Buffers still in use are dropped from the arena and freed by their last owner
+      buffers_.clear();
+      width_ = width;
+      height_ = height;
+    }
+
+    // use_count() can't grow from 1 without the lock, because only the arena owns the buffer
+    for (const std::shared_ptr<T> &buffer : buffers_)
+    {
+      if (buffer.use_count() == 1)
+        return buffer;
+    }
+
+    buffers_.push_back(std::make_shared<T>());
+    return buffers_.back();
+  }
+
+private:
+  std::mutex mutex_;
+  int width_;
+  int height_;
+  std::vector<std::shared_ptr<T>> buffers_;
+};
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__FRAME_BUFFER_ARENA_H_
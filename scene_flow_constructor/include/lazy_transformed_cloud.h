@@ -0,0 +1,81 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__LAZY_TRANSFORMED_CLOUD_H_
+#define SCENE_FLOW_CONSTRUCTOR__LAZY_TRANSFORMED_CLOUD_H_
+
+#include <geometry_msgs/Transform.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <Eigen/Geometry>
+
+#include <cstdint>
+#include <vector>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Organized pointcloud transformed point by point when each point is accessed first
+ *
+ * Only points referenced through optical flow are transformed,
+ * instead of whole pointcloud by transformPCPreviousToNow().
+ */
+class LazyTransformedCloud {
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  /**
+   * \brief Memory of transformed points and memo, kept across frames to avoid allocation
+   */
+  struct Buffer {
+    /**
+     * \brief (x, y, z, padding) of transformed points, not initialized until transformed
+     */
+    std::vector<float> points;
+    /**
+     * \brief Whether each point is already transformed, 1 bit per pixel
+     */
+    std::vector<uint64_t> memo;
+  };
+
+  /**
+   * \param source Organized pointcloud, which must be alive while this is used
+   * \param transform Transform applied to each point
+   * \param buffer Memory used by this cloud, which must not be shared while this is used
+   */
+  LazyTransformedCloud(const pcl::PointCloud<pcl::PointXYZ> &source, const geometry_msgs::Transform &transform, Buffer &buffer);
+
+  /**
+   * \brief Transformed point at (u, v). NaN point stays NaN.
+   */
+  inline pcl::PointXYZ at(int u, int v)
+  {
+    int index = v * width_ + u;
+    uint64_t bit = static_cast<uint64_t>(1) << (index % 64);
+    float* point = &points_[4 * index];
+    if ((memo_[index / 64] & bit) == 0)
+    {
+      transformPoint(index, point);
+      memo_[index / 64] |= bit;
+    }
+    return pcl::PointXYZ(point[0], point[1], point[2]);
+  }
+
+  /**
+   * \brief Number of points transformed so far
+   */
+  int getTransformedCount();
+
+private:
+  const pcl::PointCloud<pcl::PointXYZ> &source_;
+  Eigen::Isometry3d transform_;
+  int width_;
+  float* points_;
+  uint64_t* memo_;
+  size_t memo_words_;
+
+  void transformPoint(int index, float* point);
+};
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__LAZY_TRANSFORMED_CLOUD_H_
@@ -0,0 +1,61 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__MONO_IMAGE_H_
+#define SCENE_FLOW_CONSTRUCTOR__MONO_IMAGE_H_
+
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/Image.h>
+
+#include <mutex>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Input image with its MONO8 conversion, which is done at most once and shared by every stage
+ *
+ * Visual odometry, disparity and optical flow of a frame, and optical flow of the next frame,
+ * read the same buffer instead of converting the message by themselves.
+ */
+class MonoImage {
+public:
+  explicit MonoImage(const sensor_msgs::ImageConstPtr &image) : image_(image) {}
+
+  /**
+   * \brief Original message
+   */
+  inline const sensor_msgs::ImageConstPtr& message() const
+  {
+    return image_;
+  }
+
+  /**
+   * \brief MONO8 image converted at the first call
+   *
+   * Data of the message is shared without copy if it's already mono.
+   * Can be called from multiple threads at once.
+   *
+   * \throw cv_bridge::Exception if the encoding can't be converted
+   */
+  const cv::Mat& mono();
+
+  /**
+   * \brief MONO8 message of mono(), for backends which take sensor_msgs::Image
+   *
+   * The original message is returned if it's already mono.
+   * Otherwise mono() is copied into a message at the first call.
+   *
+   * \throw cv_bridge::Exception if the encoding can't be converted
+   */
+  const sensor_msgs::ImageConstPtr& monoMessage();
+
+private:
+  sensor_msgs::ImageConstPtr image_;
+
+  std::once_flag converted_;
+  cv_bridge::CvImageConstPtr mono_;
+
+  std::once_flag mono_message_created_;
+  sensor_msgs::ImageConstPtr mono_message_;
+};
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__MONO_IMAGE_H_
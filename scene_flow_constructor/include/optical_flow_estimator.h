@@ -0,0 +1,64 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__OPTICAL_FLOW_ESTIMATOR_H_
+#define SCENE_FLOW_CONSTRUCTOR__OPTICAL_FLOW_ESTIMATOR_H_
+
+#include "mono_image.h"
+
+#include <ros/ros.h>
+
+#include <opencv2/core/core.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Interface of dense optical flow estimation of left image
+ */
+class OpticalFlowEstimator {
+public:
+  virtual ~OpticalFlowEstimator() {}
+
+  /**
+   * \param image_previous, image_now Input images, whose mono conversion is shared with other stages
+   * \param flow Output CV_32FC2 image of the size of image_now.
+   *   Pixel (u, v) of image_now corresponds to (u, v) - flow(u, v) of image_previous.
+   * \return false if estimation is failed
+   */
+  virtual bool estimate(MonoImage& image_previous, MonoImage& image_now, cv::Mat& flow) = 0;
+
+  /**
+   * \brief Whether estimateInRegions() does work only inside the regions
+   */
+  virtual bool supportsRegions() const
+  {
+    return false;
+  }
+
+  /**
+   * \brief Estimate optical flow only inside the regions of image_now. Flow outside them is NaN.
+   *
+   * Default implementation estimates whole image and discards flow outside the regions,
+   * so it doesn't save any work. See supportsRegions().
+   */
+  virtual bool estimateInRegions(MonoImage& image_previous, MonoImage& image_now, const std::vector<cv::Rect>& regions, cv::Mat& flow);
+};
+
+/**
+ * \brief Create backend of optical flow estimation
+ *
+ * \param type "pwc_net" for PWC-Net on GPU, or "dis" for DIS optical flow of OpenCV on CPU
+ * \param private_node_handle Node handle to load parameters of the backend
+ * \throw std::invalid_argument if type is unknown, or its backend is not built
+ */
+std::shared_ptr<OpticalFlowEstimator> createOpticalFlowEstimator(const std::string& type, ros::NodeHandle private_node_handle);
+
+/**
+ * \brief Default type of createOpticalFlowEstimator(), "pwc_net" if it's built and "dis" otherwise
+ */
+std::string defaultOpticalFlowEstimatorType();
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__OPTICAL_FLOW_ESTIMATOR_H_
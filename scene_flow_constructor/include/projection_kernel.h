@@ -0,0 +1,41 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__PROJECTION_KERNEL_H_
+#define SCENE_FLOW_CONSTRUCTOR__PROJECTION_KERNEL_H_
+
+#include <image_geometry/pinhole_camera_model.h>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Elements of rectified projection matrix P used by image_geometry::PinholeCameraModel::project3dToPixel()
+ */
+struct ProjectionParams
+{
+  float fx;
+  float fy;
+  float cx;
+  float cy;
+  float tx;
+  float ty;
+
+  ProjectionParams() = default;
+  explicit ProjectionParams(const image_geometry::PinholeCameraModel& camera_model);
+};
+
+/**
+ * \brief Project points to image and calculate optical flow from each pixel to the projected point
+ *
+ * Same as project3dToPixel(point) - (u, v) in single precision.
+ * Uses AVX or SSE2 if the compiler enables them, and scalar code otherwise.
+ *
+ * \param points (x, y, z, w) of each pixel, same memory layout as pcl::PointXYZ. NaN points give NaN flow.
+ * \param count Number of points
+ * \param u_begin Column of the first point
+ * \param v Row of the points
+ * \param params Projection matrix
+ * \param flow Output (x, y) of optical flow at each pixel, same memory layout as CV_32FC2 image
+ */
+void projectStaticFlow(const float* points, int count, int u_begin, int v, const ProjectionParams& params, float* flow);
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__PROJECTION_KERNEL_H_
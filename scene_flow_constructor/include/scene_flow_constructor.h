@@ -2,44 +2,94 @@
 #define SCENE_FLOW_CONSTRUCTOR__SCENE_FLOW_CONSTRUCTOR_H_
 
 #include <cv_bridge/cv_bridge.h>
+#include <disparity_estimator.h>
 #include <disparity_image_proc/disparity_image_processor.h>
 #include <dynamic_reconfigure/server.h>
+#include <frame_buffer_arena.h>
 #include <geometry_msgs/TransformStamped.h>
 #include <image_geometry/pinhole_camera_model.h>
 #include <image_transport/image_transport.h>
 #include <image_transport/subscriber_filter.h>
+#include <lazy_transformed_cloud.h>
 #include <message_filters/subscriber.h>
+#include <mono_image.h>
+#include <moving_object_msgs/SparseSceneFlow.h>
 #include <message_filters/time_synchronizer.h>
-#include <pwc_net/pwc_net.h>
+#include <optical_flow_estimator.h>
 #include <ros/ros.h>
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/CameraInfo.h>
-#include <sgm_gpu/sgm_gpu.h>
 #include <stereo_msgs/DisparityImage.h>
 #include <scene_flow_constructor/pcl_point_xyz_velocity.h>
 #include <scene_flow_constructor/SceneFlowConstructorConfig.h>
+#include <stage_worker.h>
 #include <tf2/LinearMath/Transform.h>
 #include <tf2_ros/transform_broadcaster.h>
 #include <tf2_ros/transform_listener.h>
+#include <velocity_point_cloud2.h>
 #include <viso_stereo.h>
 
 #include <pcl_ros/point_cloud.h>
 #include <pcl/point_types.h>
 
-#include <thread>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <vector>
 
 namespace scene_flow_constructor{
 
 class SceneFlowConstructor {
 public:
-  SceneFlowConstructor();
+  /**
+   * \param node_handle Node handle to subscribe input topics
+   * \param private_node_handle Node handle to advertise output topics and load parameters
+   */
+  SceneFlowConstructor(ros::NodeHandle node_handle, ros::NodeHandle private_node_handle);
+  ~SceneFlowConstructor();
 private:
-  std::shared_ptr<image_transport::ImageTransport> image_transport_;
-
   /**
-    * \brief Thread to execute construct()
-    */
-  std::thread construct_thread_;
+   * \brief Input and intermediate results of a stereo frame passing through the pipeline
+   */
+  struct Frame
+  {
+    /**
+     * \brief Order of admission to the pipeline
+     */
+    uint64_t sequence;
+    ros::WallTime received_time;
+
+    // Mono conversion of the images is done once and shared by stages of this frame
+    std::shared_ptr<MonoImage> left_image;
+    std::shared_ptr<MonoImage> right_image;
+    sensor_msgs::CameraInfoConstPtr left_camera_info;
+    sensor_msgs::CameraInfoConstPtr right_camera_info;
+    /**
+     * \brief Left image of previously admitted frame, already converted by its stages. nullptr at the first frame.
+     */
+    std::shared_ptr<MonoImage> previous_left_image;
+
+    // Results of each stage, nullptr if the stage failed
+    std::shared_ptr<DisparityImageProcessor> disparity;
+    geometry_msgs::TransformPtr transform_prev2now;
+    std::shared_ptr<cv_bridge::CvImage> left_flow;
+    /**
+     * \brief Regions of left image where moving objects can be, found by sparse-first mode.
+     * nullptr if whole image is processed.
+     */
+    std::shared_ptr<std::vector<cv::Rect>> candidate_regions;
+
+    std::shared_future<void> disparity_finished;
+    std::shared_future<void> camera_motion_finished;
+    /**
+     * \brief Invalid at the first frame
+     */
+    std::shared_future<void> optical_flow_finished;
+  };
+
+  std::shared_ptr<image_transport::ImageTransport> image_transport_;
   
   /**
    * \brief Publisher for optical flow of left image
@@ -51,6 +101,7 @@ private:
   ros::Publisher depth_pub_;
   ros::Publisher pc_with_velocity_pub_;
   ros::Publisher static_flow_pub_;
+  ros::Publisher sparse_scene_flow_pub_;
 
   // Stereo image and camera info subscribers
   image_transport::SubscriberFilter left_image_sub_;
@@ -72,6 +123,10 @@ private:
    * \brief Difference[pixel] between optical flow and calculated static optical flow treated as dynamic pixel
    */
   int dynamic_flow_diff_;
+  /**
+   * \brief Points whose velocity length[m/s] is at least this are published as sparse scene flow
+   */
+  double sparse_dynamic_speed_;
 
   /**
    * \brief Parameter used by visualization of velocity pc on image plane
@@ -79,11 +134,92 @@ private:
    */
   double max_color_velocity_;
 
-  sensor_msgs::ImageConstPtr previous_left_image_;
+  /**
+   * \brief Construct velocity pointcloud by constructVelocityPCFused() while static optical flow isn't subscribed
+   */
+  bool use_fused_kernel_;
+  /**
+   * \brief Transform points of previous frame only when they are referenced, while static optical flow isn't subscribed
+   */
+  bool use_lazy_transform_;
+  /**
+   * \brief Estimate optical flow only around features which are outliers of visual odometry
+   */
+  bool use_sparse_first_;
+  /**
+   * \brief Size[pixel] of grid cells where outlier features are counted in sparse-first mode
+   */
+  int sparse_first_cell_size_;
+  /**
+   * \brief Number of outlier features in a cell to treat the cell as candidate of moving object
+   */
+  int sparse_first_min_outliers_;
+
+  /**
+   * \brief Look up camera motion from TF instead of visual odometry
+   */
+  bool use_tf_camera_motion_;
+  /**
+   * \brief Frame fixed to the world, through which camera poses at previous and now frame are connected
+   */
+  std::string tf_camera_motion_fixed_frame_id_;
+  /**
+   * \brief Time to wait for TF of now frame. Zero doesn't block and skips the frame if TF isn't available yet.
+   */
+  ros::Duration tf_camera_motion_timeout_;
+
+  /**
+   * \brief Persistent threads to reproject disparity to pointcloud in parallel
+   */
+  std::shared_ptr<disparity_image_proc::ThreadPool> reprojection_thread_pool_;
+
+  /**
+   * \brief Guards waiting_frames_, frames_in_flight_, next_sequence_, previous_left_image_ and pipeline_stopped_
+   */
+  std::mutex pipeline_mutex_;
+  /**
+   * \brief Frames received but not admitted to the pipeline yet
+   */
+  std::deque<std::shared_ptr<Frame>> waiting_frames_;
+  /**
+   * \brief Number of admitted frames whose construct() isn't finished
+   */
+  int frames_in_flight_;
+  uint64_t next_sequence_;
+  bool pipeline_stopped_;
+  /**
+   * \brief Left image of last admitted frame
+   */
+  std::shared_ptr<MonoImage> previous_left_image_;
+
+  int max_frames_in_flight_;
+  int max_waiting_frames_;
+  /**
+   * \brief Drop the oldest waiting frame when waiting_frames_ is full. The newest frame is dropped if false.
+   */
+  bool drop_oldest_frame_;
+
+  /**
+   * \brief Disparity of last constructed frame, accessed only by construct_worker_
+   */
   std::shared_ptr<DisparityImageProcessor> disparity_previous_;
-  std::shared_ptr<DisparityImageProcessor> disparity_now_;
-  std::shared_ptr<cv_bridge::CvImage> left_flow_;
-  geometry_msgs::TransformPtr transform_prev2now_;
+
+  /**
+   * \brief Pointcloud reprojected from disparity, kept to be reused as pointcloud of previous frame
+   */
+  struct ReprojectedPointcloud
+  {
+    /**
+     * \brief Source disparity, which also has validity mask of the pointcloud
+     */
+    std::shared_ptr<DisparityImageProcessor> disparity;
+    std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> pointcloud;
+  };
+  /**
+   * \brief Ring buffer of pointclouds of recent frames, accessed only by construct_worker_
+   */
+  std::array<ReprojectedPointcloud, 2> reprojected_pointclouds_;
+  size_t next_reprojected_index_;
 
   std::string camera_frame_id_;
 
@@ -113,52 +249,163 @@ private:
    */
   tf2::Transform integrated_pose_;
 
-  std::shared_ptr<sgm_gpu::SgmGpu> sgm_gpu_;
+  /**
+   * \brief Backend of disparity estimation selected by ~disparity_estimator
+   */
+  std::shared_ptr<DisparityEstimator> disparity_estimator_;
+
+  /**
+   * \brief Backend of optical flow estimation selected by ~optical_flow_estimator
+   */
+  std::shared_ptr<OpticalFlowEstimator> optical_flow_estimator_;
+
+  // Per-frame buffers recycled across frames
+  FrameBufferArena<pcl::PointCloud<pcl::PointXYZ>> pointcloud_arena_;
+  /**
+   * \brief Messages of velocity pointcloud, written in place through VelocityPointCloud2
+   */
+  FrameBufferArena<sensor_msgs::PointCloud2> velocity_msg_arena_;
+  /**
+   * \brief Images of optical flow and static optical flow
+   */
+  FrameBufferArena<cv_bridge::CvImage> flow_image_arena_;
+  FrameBufferArena<cv::Mat> depth_image_arena_;
+  FrameBufferArena<LazyTransformedCloud::Buffer> lazy_transform_arena_;
+  /**
+   * \brief Non-zero inside candidate regions of sparse-first mode, reused by construct() of each frame
+   */
+  cv::Mat candidate_mask_;
+  /**
+   * \brief Pixel indices (v * width + u) of points found by the last velocity pass to be at least sparse_dynamic_speed_, in row-major order
+   */
+  std::vector<uint32_t> dynamic_pixel_indices_;
+
+  // Persistent threads of each stage, declared last to be stopped before other members are destroyed.
+  // The destructor unsubscribes inputs before stopping them.
+  std::shared_ptr<StageWorker> disparity_worker_;
+  std::shared_ptr<StageWorker> camera_motion_worker_;
+  std::shared_ptr<StageWorker> optical_flow_worker_;
+  std::shared_ptr<StageWorker> construct_worker_;
+
+  /**
+   * \brief Admit waiting frames to the pipeline while number of frames in flight is under the limit
+   *
+   * pipeline_mutex_ must be locked by caller.
+   */
+  void admitWaitingFrames();
 
-  pwc_net::PwcNet pwc_net_;
+  /**
+   * \brief Find pointcloud reprojected from the disparity in reprojected_pointclouds_
+   *
+   * \return nullptr if it isn't found
+   */
+  std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> findReprojectedPointcloud(const std::shared_ptr<DisparityImageProcessor> &disparity);
+  void storeReprojectedPointcloud(const std::shared_ptr<DisparityImageProcessor> &disparity, const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &pointcloud);
 
   /**
    * \brief Calculate optical flow of left frame with static assumption
    */
-  void calculateStaticOpticalFlow(const pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed, cv::Mat &left_static_flow);
+  void calculateStaticOpticalFlow(const pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed, DisparityImageProcessor &disparity_previous, cv::Mat &left_static_flow);
 
   /**
    * \brief construct various data from disparity prev/now, left optical flow and camera movement
+   *
+   * \param candidate_regions Regions found by sparse-first mode, where velocity is estimated.
+   *   Valid points outside them are static. nullptr if whole image is processed.
    */
   void construct
   (
     std::shared_ptr<DisparityImageProcessor> disparity_now,
     std::shared_ptr<DisparityImageProcessor> disparity_previous,
     std::shared_ptr<cv_bridge::CvImage> left_flow,
-    geometry_msgs::TransformPtr transform_prev2now
+    geometry_msgs::TransformPtr transform_prev2now,
+    const std::vector<cv::Rect>* candidate_regions = nullptr
   );
 
+  /**
+   * \brief Fill candidate_mask_ by candidate regions
+   *
+   * \return candidate_mask_, or nullptr if candidate_regions is nullptr
+   */
+  const cv::Mat* makeCandidateMask(const std::vector<cv::Rect>* candidate_regions);
+
+  /**
+   * \brief Wait for estimation stages of the frame and call construct(), on construct_worker_
+   */
+  void constructFrame(std::shared_ptr<Frame> frame);
+
   /**
    * \brief Calculate velocity of each point and construct pointcloud.
+   *
+   * \param pc_previous_transformed Pointcloud of previous frame transformed to now frame,
+   *   pcl::PointCloud<pcl::PointXYZ> or LazyTransformedCloud
+   * \param static_flow_at Function which returns static optical flow at a pixel (cv::Point2i) as cv::Vec2f
+   * \param candidate_mask Velocity is estimated only where the mask is non-zero, and zero elsewhere. nullptr for whole image.
    */
-  void constructVelocityPC
+  template <typename PreviousCloudT, typename StaticFlowFunction> void constructVelocityPC
   (
     const pcl::PointCloud<pcl::PointXYZ> &pc_now,
-    const pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed,
+    PreviousCloudT &pc_previous_transformed,
     cv_bridge::CvImage &left_flow,
-    cv::Mat &left_static_flow,
+    StaticFlowFunction static_flow_at,
     DisparityImageProcessor &disparity_now,
     DisparityImageProcessor &disparity_previous,
-    pcl::PointCloud<pcl::PointXYZVelocity> &velocity_pc
+    VelocityPointCloud2 &velocity_pc,
+    const cv::Mat* candidate_mask
+  );
+
+  /**
+   * \brief Set velocity of a dynamic point, and add its pixel to dynamic_pixel_indices_ if it's at least sparse_dynamic_speed
+   */
+  void setDynamicVelocity(int u, int v, float vx, float vy, float vz, float sparse_dynamic_speed, VelocityPointCloud2 &velocity_pc);
+
+  /**
+   * \brief Same as constructVelocityPC(), but without intermediate pointclouds and static optical flow image
+   *
+   * Points of now and previous frame are reprojected from disparity, transformed and projected per pixel
+   * only when they are needed.
+   */
+  void constructVelocityPCFused
+  (
+    DisparityImageProcessor &disparity_now,
+    DisparityImageProcessor &disparity_previous,
+    cv_bridge::CvImage &left_flow,
+    const geometry_msgs::Transform &previous_to_now,
+    VelocityPointCloud2 &velocity_pc,
+    const cv::Mat* candidate_mask
   );
 
   /**
    * \brief Estimate left camera motion by LIBVISO2
    */
-  void estimateCameraMotion(const sensor_msgs::ImageConstPtr& left_image, const sensor_msgs::ImageConstPtr& right_image, const sensor_msgs::CameraInfoConstPtr& left_camera_info, const sensor_msgs::CameraInfoConstPtr& right_camera_info);
+  geometry_msgs::TransformPtr estimateCameraMotion(MonoImage& left_image, MonoImage& right_image, const sensor_msgs::CameraInfoConstPtr& left_camera_info, const sensor_msgs::CameraInfoConstPtr& right_camera_info);
+  /**
+   * \brief Look up left camera motion from previous to now frame in tf_buffer_
+   *
+   * TF is interpolated at timestamps of both images, so odometry published at other rates can be used.
+   * \param previous_header, header Headers of previous and now left image
+   * \return nullptr if TF isn't available
+   */
+  geometry_msgs::TransformPtr lookupCameraMotion(const std_msgs::Header& previous_header, const std_msgs::Header& header);
   /**
-   * \brief Estimate disparity by SGM
+   * \brief Estimate disparity by disparity_estimator_
    */
-  void estimateDisparity(const sensor_msgs::ImageConstPtr& left_image, const sensor_msgs::ImageConstPtr& right_image, const sensor_msgs::CameraInfoConstPtr& left_camera_info, const sensor_msgs::CameraInfoConstPtr& right_camera_info);
+  std::shared_ptr<DisparityImageProcessor> estimateDisparity(MonoImage& left_image, MonoImage& right_image, const sensor_msgs::CameraInfoConstPtr& left_camera_info, const sensor_msgs::CameraInfoConstPtr& right_camera_info);
   /**
-   * \brief Estimate optical flow by PWC-Net
+   * \brief Estimate optical flow from previous to now left image by optical_flow_estimator_
    */
-  void estimateOpticalFlow(const sensor_msgs::ImageConstPtr& left_image);
+  std::shared_ptr<cv_bridge::CvImage> estimateOpticalFlow(MonoImage& previous_left_image, MonoImage& left_image, const std::vector<cv::Rect>* regions = nullptr);
+
+  /**
+   * \brief Find regions of moving object candidates from feature matches of the last visual odometry
+   *
+   * Features rejected as outliers of camera motion are counted in each grid cell,
+   * and bounding boxes of connected candidate cells are returned with margin of one cell.
+   * Each box is grown to cover previous positions of its outlier features,
+   * so optical flow of the region can follow objects moving faster than its padding.
+   * Must be called on camera_motion_worker_ after successful estimateCameraMotion().
+   */
+  std::shared_ptr<std::vector<cv::Rect>> findCandidateRegions(int width, int height);
 
   /**
    * \brief Get points in 3 images (left previous, right now  and right previous frame) which match to a point in left now image
@@ -214,10 +461,13 @@ private:
   }
   inline bool getRightPoint(const cv::Point2i &left, cv::Point2i &right, DisparityImageProcessor &disparity_processor)
   {
-    float disparity;
-    if (!disparity_processor.getDisparity(left.x, left.y, disparity))
+    if (!disparity_processor.isValidPixel(left.x, left.y))
       return false;
-    if (std::isnan(disparity) || std::isinf(disparity) || disparity < 0)
+
+    // Validity mask accepts negative disparity when min_disparity of the message is negative
+    float disparity;
+    disparity_processor.getDisparity(left.x, left.y, disparity);
+    if (disparity < 0)
       return false;
 
     right.x = std::round(left.x - disparity);
@@ -228,35 +478,27 @@ private:
 
   void initializeOdometer(const sensor_msgs::CameraInfo& l_info_msg, const sensor_msgs::CameraInfo& r_info_msg);
 
-  /**
-   * \brief Resize velocity pointcloud and fill each point by default value
-   *
-   * \param velocity_pc Target velocity pointcloud
-   */
-  void initializeVelocityPC(pcl::PointCloud<pcl::PointXYZVelocity> &velocity_pc);
-
   void integrateAndBroadcastTF(const tf2::Transform& delta_transform, const ros::Time& timestamp);
 
-  inline bool isValid(const pcl::PointXYZ &point)
-  {
-    if (std::isnan(point.x))
-      return false;
-
-    if (std::isinf(point.x))
-      return false;
-
-    return true;
-  }
-
   void publishDepthImage(ros::Publisher& depth_pub, cv::Mat& depth_image, ros::Time timestamp);
 
-  template <typename PointT> void publishPointcloud
+  /**
+   * \brief Publish message as ConstPtr, which is passed to subscribers in the same nodelet manager without copy
+   *
+   * The message must not be modified after this.
+   */
+  void publishPointcloud
   (
     const ros::Publisher &publisher,
-    const pcl::PointCloud<PointT> &pointcloud,
+    const std::shared_ptr<sensor_msgs::PointCloud2> &pointcloud_msg,
     const std_msgs::Header &header
   );
 
+  /**
+   * \brief Publish only points in dynamic_pixel_indices_, whose velocity is at least sparse_dynamic_speed_, with their pixel indices
+   */
+  void publishSparseSceneFlow(VelocityPointCloud2 &velocity_pc, const std_msgs::Header &header);
+
   void reconfigureCB(scene_flow_constructor::SceneFlowConstructorConfig& config, uint32_t level);
 
   /**
@@ -268,10 +510,11 @@ private:
    * \brief Transform pointcloud of previous frame to now frame
    *
    * \param pc_previous Pointcloud of previous frame
+   * \param disparity_previous Disparity of previous frame, whose validity mask selects points to transform
    * \param pc_previous_transformed Transformed pointcloud of previous frame
    * \param previous_to_now Transform from now frame to previous frame
    */
-  void transformPCPreviousToNow(const pcl::PointCloud<pcl::PointXYZ> &pc_previous, pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed, const geometry_msgs::Transform &previous_to_now);
+  void transformPCPreviousToNow(const pcl::PointCloud<pcl::PointXYZ> &pc_previous, DisparityImageProcessor &disparity_previous, pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed, const geometry_msgs::Transform &previous_to_now);
 };
 
 } // namespace scene_flow_constructor
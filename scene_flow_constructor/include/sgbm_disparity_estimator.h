@@ -0,0 +1,93 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__SGBM_DISPARITY_ESTIMATOR_H_
+#define SCENE_FLOW_CONSTRUCTOR__SGBM_DISPARITY_ESTIMATOR_H_
+
+#include "disparity_estimator.h"
+
+#include <opencv2/calib3d/calib3d.hpp>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Disparity estimation on CPU by cv::StereoSGBM
+ *
+ * 3-way mode of cv::StereoSGBM aggregates costs with SIMD and processes bands of rows in parallel,
+ * so it runs in predictable time without GPU.
+ */
+class SgbmDisparityEstimator : public DisparityEstimator {
+public:
+  struct Parameters
+  {
+    int min_disparity = 0;
+    /**
+     * \brief Rounded up to multiple of 16
+     */
+    int num_disparities = 128;
+    int block_size = 5;
+    /**
+     * \brief Penalties of disparity change by 1 and by more than 1. 8 * block_size^2 and 32 * block_size^2 if negative.
+     */
+    int p1 = -1;
+    int p2 = -1;
+    int disp12_max_diff = 1;
+    int pre_filter_cap = 63;
+    int uniqueness_ratio = 10;
+    int speckle_window_size = 100;
+    int speckle_range = 2;
+  };
+
+  explicit SgbmDisparityEstimator(const Parameters& parameters);
+
+  /**
+   * \brief Load parameters under "sgbm" namespace of the node handle
+   */
+  static Parameters loadParameters(ros::NodeHandle private_node_handle);
+
+  bool estimate
+  (
+    MonoImage& left_image,
+    MonoImage& right_image,
+    const sensor_msgs::CameraInfo& left_camera_info,
+    const sensor_msgs::CameraInfo& right_camera_info,
+    stereo_msgs::DisparityImage& disparity
+  ) override;
+  /**
+   * \brief Hand fixed-point disparity to the processor, which converts it to depth by lookup table
+   */
+  std::shared_ptr<DisparityImageProcessor> estimateProcessor
+  (
+    MonoImage& left_image,
+    MonoImage& right_image,
+    const sensor_msgs::CameraInfoConstPtr& left_camera_info,
+    const sensor_msgs::CameraInfoConstPtr& right_camera_info
+  ) override;
+
+private:
+  cv::Ptr<cv::StereoSGBM> stereo_matcher_;
+  /**
+   * \brief Fixed-point output of stereo_matcher_, reused between frames
+   */
+  cv::Mat disparity16_;
+
+  /**
+   * \brief Estimate fixed-point disparity
+   *
+   * Offset of principal points is added in fixed-point, so the disparity stays on steps of delta_d.
+   *
+   * \param fixed_point_disparity Output CV_16SC1 disparity multiplied by cv::StereoMatcher::DISP_SCALE, newly allocated
+   * \param disparity_info Output header, camera parameters, disparity range and valid window. Image isn't filled.
+   * \return false if estimation is failed
+   */
+  bool estimateFixedPoint
+  (
+    MonoImage& left_image,
+    MonoImage& right_image,
+    const sensor_msgs::CameraInfo& left_camera_info,
+    const sensor_msgs::CameraInfo& right_camera_info,
+    cv::Mat& fixed_point_disparity,
+    stereo_msgs::DisparityImage& disparity_info
+  );
+};
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__SGBM_DISPARITY_ESTIMATOR_H_
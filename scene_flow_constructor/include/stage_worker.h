@@ -0,0 +1,58 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__STAGE_WORKER_H_
+#define SCENE_FLOW_CONSTRUCTOR__STAGE_WORKER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Persistent thread which executes tasks of a processing stage in FIFO order
+ *
+ * The thread is created once and reused by every frame,
+ * so stereoCallback doesn't pay for thread creation and cold stacks.
+ */
+class StageWorker {
+public:
+  /**
+   * \param name Name of the stage, used as thread name and in logs
+   * \param cpu CPU core which the thread is pinned to. The thread isn't pinned if negative.
+   */
+  StageWorker(const std::string& name, int cpu = -1);
+  /**
+   * \brief Wait for queued tasks and stop the thread
+   */
+  ~StageWorker();
+
+  StageWorker(const StageWorker&) = delete;
+  StageWorker& operator=(const StageWorker&) = delete;
+
+  /**
+   * \brief Queue a task
+   *
+   * \return Future which becomes ready when the task is finished. Exception thrown by the task is rethrown by get().
+   */
+  std::future<void> push(std::function<void()> task);
+
+private:
+  std::string name_;
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::deque<std::packaged_task<void()>> tasks_;
+  bool stop_;
+
+  std::thread thread_;
+
+  void pinToCpu(int cpu);
+  void workerLoop();
+};
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__STAGE_WORKER_H_
@@ -0,0 +1,87 @@
+#ifndef SCENE_FLOW_CONSTRUCTOR__VELOCITY_POINT_CLOUD2_H_
+#define SCENE_FLOW_CONSTRUCTOR__VELOCITY_POINT_CLOUD2_H_
+
+#include <scene_flow_constructor/pcl_point_xyz_velocity.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Organized pointcloud of pcl::PointXYZVelocity written directly in data of sensor_msgs::PointCloud2
+ *
+ * Layout of the message is the same as pcl::toROSMsg() of pcl::PointCloud<pcl::PointXYZVelocity>,
+ * so subscribers convert it by pcl::fromROSMsg() as before, but publisher doesn't copy the whole frame.
+ * Fields are written at their offsets by memcpy, so data of the message doesn't have to be aligned.
+ */
+class VelocityPointCloud2 {
+public:
+  /**
+   * \brief Resize the message, set its fields and fill each point by NaN
+   *
+   * Memory of recycled message is reused.
+   *
+   * \param msg Message which must be alive while this is used. Header is not changed.
+   */
+  VelocityPointCloud2(sensor_msgs::PointCloud2 &msg, int width, int height);
+
+  /**
+   * \brief Set (x, y, z) of the point at (u, v)
+   */
+  inline void setPoint(int u, int v, float x, float y, float z)
+  {
+    const float point[3] = {x, y, z};
+    std::memcpy(pointData(u, v) + offsetof(pcl::PointXYZVelocity, x), point, sizeof(point));
+  }
+
+  /**
+   * \brief Set (vx, vy, vz) of the point at (u, v)
+   */
+  inline void setVelocity(int u, int v, float vx, float vy, float vz)
+  {
+    const float velocity[3] = {vx, vy, vz};
+    std::memcpy(pointData(u, v) + offsetof(pcl::PointXYZVelocity, vx), velocity, sizeof(velocity));
+  }
+
+  /**
+   * \brief Get (vx, vy, vz) of the point at (u, v)
+   */
+  inline void getVelocity(int u, int v, float &vx, float &vy, float &vz) const
+  {
+    float velocity[3];
+    std::memcpy(velocity, pointData(u, v) + offsetof(pcl::PointXYZVelocity, vx), sizeof(velocity));
+    vx = velocity[0];
+    vy = velocity[1];
+    vz = velocity[2];
+  }
+
+  /**
+   * \brief Copy the whole point at (source_u, source_v) of another cloud to (u, v)
+   */
+  inline void copyPoint(int u, int v, const VelocityPointCloud2 &source, int source_u, int source_v)
+  {
+    std::memcpy(pointData(u, v), source.pointData(source_u, source_v), sizeof(pcl::PointXYZVelocity));
+  }
+
+  /**
+   * \brief Fields of pcl::PointXYZVelocity, computed once
+   */
+  static const std::vector<sensor_msgs::PointField>& fields();
+
+private:
+  uint8_t* data_;
+  int width_;
+
+  inline uint8_t* pointData(int u, int v) const
+  {
+    return data_ + (static_cast<size_t>(v) * width_ + u) * sizeof(pcl::PointXYZVelocity);
+  }
+};
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR__VELOCITY_POINT_CLOUD2_H_
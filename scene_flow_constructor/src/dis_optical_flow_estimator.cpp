@@ -0,0 +1,123 @@
+#include "dis_optical_flow_estimator.h"
+
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_DIS
+
+#include <cv_bridge/cv_bridge.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if CV_VERSION_MAJOR < 4
+#include <opencv2/optflow.hpp>
+#endif
+
+namespace scene_flow_constructor {
+
+namespace {
+
+#if CV_VERSION_MAJOR >= 4
+typedef cv::DISOpticalFlow DISOpticalFlow;
+#else
+typedef cv::optflow::DISOpticalFlow DISOpticalFlow;
+#endif
+
+} // namespace
+
+DisOpticalFlowEstimator::DisOpticalFlowEstimator(const Parameters& parameters) : region_padding_(std::max(parameters.region_padding, 0))
+{
+  int preset = DISOpticalFlow::PRESET_FAST;
+  if (parameters.preset == "ultrafast")
+    preset = DISOpticalFlow::PRESET_ULTRAFAST;
+  else if (parameters.preset == "medium")
+    preset = DISOpticalFlow::PRESET_MEDIUM;
+  else if (parameters.preset != "fast")
+    ROS_WARN_STREAM("Unknown preset of DIS optical flow: " << parameters.preset << ", fast is used");
+
+#if CV_VERSION_MAJOR >= 4
+  dis_ = cv::DISOpticalFlow::create(preset);
+#else
+  dis_ = cv::optflow::createOptFlow_DIS(preset);
+#endif
+}
+
+DisOpticalFlowEstimator::Parameters DisOpticalFlowEstimator::loadParameters(ros::NodeHandle private_node_handle)
+{
+  ros::NodeHandle dis_nh(private_node_handle, "dis");
+  Parameters parameters;
+  dis_nh.param("preset", parameters.preset, parameters.preset);
+  dis_nh.param("region_padding", parameters.region_padding, parameters.region_padding);
+  return parameters;
+}
+
+bool DisOpticalFlowEstimator::estimate(MonoImage& image_previous, MonoImage& image_now, cv::Mat& flow)
+{
+  cv::Mat mono_previous, mono_now;
+  if (!convertToMono(image_previous, image_now, mono_previous, mono_now))
+    return false;
+
+  calculateFlow(mono_previous, mono_now, flow);
+  return true;
+}
+
+bool DisOpticalFlowEstimator::estimateInRegions(MonoImage& image_previous, MonoImage& image_now, const std::vector<cv::Rect>& regions, cv::Mat& flow)
+{
+  cv::Mat mono_previous, mono_now;
+  if (!convertToMono(image_previous, image_now, mono_previous, mono_now))
+    return false;
+
+  flow.create(mono_now.size(), CV_32FC2);
+  flow.setTo(cv::Scalar(std::nanf(""), std::nanf("")));
+
+  cv::Rect image_rect(0, 0, mono_now.cols, mono_now.rows);
+  cv::Mat region_flow;
+  for (const cv::Rect& region : regions)
+  {
+    cv::Rect clipped_region = region & image_rect;
+    if (clipped_region.area() == 0)
+      continue;
+
+    // Same crop of both images. Flow can't go out of the crop,
+    // so the regions must cover positions of their objects in both images.
+    cv::Rect padded_region = cv::Rect(clipped_region.x - region_padding_, clipped_region.y - region_padding_,
+      clipped_region.width + 2 * region_padding_, clipped_region.height + 2 * region_padding_) & image_rect;
+    calculateFlow(mono_previous(padded_region), mono_now(padded_region), region_flow);
+
+    cv::Rect region_in_padded = clipped_region - padded_region.tl();
+    region_flow(region_in_padded).copyTo(flow(clipped_region));
+  }
+  return true;
+}
+
+bool DisOpticalFlowEstimator::convertToMono(MonoImage& image_previous, MonoImage& image_now, cv::Mat& mono_previous, cv::Mat& mono_now)
+{
+  try
+  {
+    // Previous image was already converted when it was the now image of the last frame
+    mono_previous = image_previous.mono();
+    mono_now = image_now.mono();
+  }
+  catch (const cv_bridge::Exception& e)
+  {
+    ROS_ERROR_STREAM("Failed to convert images for optical flow: " << e.what());
+    return false;
+  }
+
+  if (mono_previous.size() != mono_now.size())
+  {
+    ROS_ERROR_STREAM("Size of previous and now image are different");
+    return false;
+  }
+  return true;
+}
+
+void DisOpticalFlowEstimator::calculateFlow(const cv::Mat& previous, const cv::Mat& now, cv::Mat& flow)
+{
+  // Flow is estimated at pixels of now image, so (u, v) + backward_flow_ is the pixel in previous image
+  dis_->calc(now, previous, backward_flow_);
+
+  backward_flow_.convertTo(flow, CV_32FC2, -1.0);
+}
+
+} // namespace scene_flow_constructor
+
+#endif // SCENE_FLOW_CONSTRUCTOR_HAVE_DIS
@@ -0,0 +1,95 @@
+#include "disparity_estimator.h"
+#include "sgbm_disparity_estimator.h"
+
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_SGM_GPU
+#include <sgm_gpu/sgm_gpu.h>
+#endif
+
+#include <stdexcept>
+
+namespace scene_flow_constructor {
+
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_SGM_GPU
+namespace {
+
+/**
+ * \brief Disparity estimation by SGM on GPU
+ */
+class SgmGpuDisparityEstimator : public DisparityEstimator {
+public:
+  explicit SgmGpuDisparityEstimator(ros::NodeHandle private_node_handle) : sgm_gpu_(private_node_handle) {}
+
+  bool estimate
+  (
+    MonoImage& left_image,
+    MonoImage& right_image,
+    const sensor_msgs::CameraInfo& left_camera_info,
+    const sensor_msgs::CameraInfo& right_camera_info,
+    stereo_msgs::DisparityImage& disparity
+  ) override
+  {
+    // Mono conversion is shared with visual odometry, so SGM doesn't convert color images again
+    sensor_msgs::ImageConstPtr left_mono, right_mono;
+    try
+    {
+      left_mono = left_image.monoMessage();
+      right_mono = right_image.monoMessage();
+    }
+    catch (const cv_bridge::Exception& e)
+    {
+      ROS_ERROR_STREAM("Failed to convert images for disparity estimation: " << e.what());
+      return false;
+    }
+    return sgm_gpu_.computeDisparity(*left_mono, *right_mono, left_camera_info, right_camera_info, disparity);
+  }
+
+private:
+  sgm_gpu::SgmGpu sgm_gpu_;
+};
+
+} // namespace
+#endif
+
+std::shared_ptr<DisparityImageProcessor> DisparityEstimator::estimateProcessor
+(
+  MonoImage& left_image,
+  MonoImage& right_image,
+  const sensor_msgs::CameraInfoConstPtr& left_camera_info,
+  const sensor_msgs::CameraInfoConstPtr& right_camera_info
+)
+{
+  stereo_msgs::DisparityImagePtr disparity(new stereo_msgs::DisparityImage());
+  if (!estimate(left_image, right_image, *left_camera_info, *right_camera_info, *disparity))
+    return nullptr;
+
+  // Hand the message to the processor without copying disparity image
+  return std::make_shared<DisparityImageProcessor>(disparity, left_camera_info);
+}
+
+std::string defaultDisparityEstimatorType()
+{
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_SGM_GPU
+  return "sgm_gpu";
+#else
+  return "sgbm";
+#endif
+}
+
+std::shared_ptr<DisparityEstimator> createDisparityEstimator(const std::string& type, ros::NodeHandle private_node_handle)
+{
+  // GPU is initialized only when its backend is selected, so CPU-only machines can run with "sgbm"
+  if (type == "sgm_gpu")
+  {
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_SGM_GPU
+    return std::make_shared<SgmGpuDisparityEstimator>(private_node_handle);
+#else
+    throw std::invalid_argument("Disparity estimator sgm_gpu is not built because sgm_gpu package was not found. Use sgbm instead.");
+#endif
+  }
+  else if (type == "sgbm")
+    return std::make_shared<SgbmDisparityEstimator>(SgbmDisparityEstimator::loadParameters(private_node_handle));
+
+  throw std::invalid_argument("Unknown disparity estimator: " + type);
+}
+
+} // namespace scene_flow_constructor
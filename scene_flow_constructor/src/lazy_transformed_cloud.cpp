@@ -0,0 +1,44 @@
+#include "lazy_transformed_cloud.h"
+
+#include <tf2_eigen/tf2_eigen.h>
+
+#include <cmath>
+
+namespace scene_flow_constructor {
+
+LazyTransformedCloud::LazyTransformedCloud(const pcl::PointCloud<pcl::PointXYZ> &source, const geometry_msgs::Transform &transform, Buffer &buffer)
+  : source_(source), transform_(tf2::transformToEigen(transform)), width_(source.width)
+{
+  // Recycled buffer of the same resolution keeps its capacity, so only the memo is cleared
+  buffer.points.resize(4 * source.points.size());
+  buffer.memo.assign((source.points.size() + 63) / 64, 0);
+  points_ = buffer.points.data();
+  memo_ = buffer.memo.data();
+  memo_words_ = buffer.memo.size();
+}
+
+int LazyTransformedCloud::getTransformedCount()
+{
+  int count = 0;
+  for (size_t i = 0; i < memo_words_; i++)
+    count += __builtin_popcountll(memo_[i]);
+  return count;
+}
+
+void LazyTransformedCloud::transformPoint(int index, float* point)
+{
+  const pcl::PointXYZ &source_point = source_.points[index];
+  if (std::isnan(source_point.x))
+  {
+    point[0] = point[1] = point[2] = source_point.x;
+    return;
+  }
+
+  // Same precision as transformPCPreviousToNow()
+  Eigen::Vector3d transformed = transform_ * Eigen::Vector3d(source_point.x, source_point.y, source_point.z);
+  point[0] = transformed.x();
+  point[1] = transformed.y();
+  point[2] = transformed.z();
+}
+
+} // namespace scene_flow_constructor
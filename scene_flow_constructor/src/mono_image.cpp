@@ -0,0 +1,30 @@
+#include "mono_image.h"
+
+#include <sensor_msgs/image_encodings.h>
+
+namespace scene_flow_constructor {
+
+const cv::Mat& MonoImage::mono()
+{
+  // If the conversion throws, the next call tries it again
+  std::call_once(converted_, [this]
+  {
+    mono_ = cv_bridge::toCvShare(image_, sensor_msgs::image_encodings::MONO8);
+  });
+  return mono_->image;
+}
+
+const sensor_msgs::ImageConstPtr& MonoImage::monoMessage()
+{
+  std::call_once(mono_message_created_, [this]
+  {
+    const cv::Mat& mono_image = mono();
+    if (image_->encoding == sensor_msgs::image_encodings::MONO8)
+      mono_message_ = image_;
+    else
+      mono_message_ = cv_bridge::CvImage(image_->header, sensor_msgs::image_encodings::MONO8, mono_image).toImageMsg();
+  });
+  return mono_message_;
+}
+
+} // namespace scene_flow_constructor
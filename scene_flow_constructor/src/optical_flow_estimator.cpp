@@ -0,0 +1,80 @@
+#include "optical_flow_estimator.h"
+#include "dis_optical_flow_estimator.h"
+
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_PWC_NET
+#include <pwc_net/pwc_net.h>
+#endif
+
+#include <cmath>
+#include <stdexcept>
+
+namespace scene_flow_constructor {
+
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_PWC_NET
+namespace {
+
+/**
+ * \brief Optical flow estimation by PWC-Net on GPU
+ */
+class PwcNetOpticalFlowEstimator : public OpticalFlowEstimator {
+public:
+  bool estimate(MonoImage& image_previous, MonoImage& image_now, cv::Mat& flow) override
+  {
+    // PWC-Net takes color images, so the original messages are passed instead of the shared mono conversion
+    return pwc_net_.estimateOpticalFlow(*image_previous.message(), *image_now.message(), flow);
+  }
+
+private:
+  pwc_net::PwcNet pwc_net_;
+};
+
+} // namespace
+#endif
+
+bool OpticalFlowEstimator::estimateInRegions(MonoImage& image_previous, MonoImage& image_now, const std::vector<cv::Rect>& regions, cv::Mat& flow)
+{
+  cv::Mat whole_flow;
+  if (!estimate(image_previous, image_now, whole_flow))
+    return false;
+
+  flow.create(whole_flow.size(), CV_32FC2);
+  flow.setTo(cv::Scalar(std::nanf(""), std::nanf("")));
+  cv::Rect image_rect(0, 0, whole_flow.cols, whole_flow.rows);
+  for (const cv::Rect& region : regions)
+    whole_flow(region & image_rect).copyTo(flow(region & image_rect));
+  return true;
+}
+
+std::string defaultOpticalFlowEstimatorType()
+{
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_PWC_NET
+  return "pwc_net";
+#else
+  return "dis";
+#endif
+}
+
+std::shared_ptr<OpticalFlowEstimator> createOpticalFlowEstimator(const std::string& type, ros::NodeHandle private_node_handle)
+{
+  // PWC-Net is loaded only when its backend is selected, so CPU-only machines can run with "dis"
+  if (type == "pwc_net")
+  {
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_PWC_NET
+    return std::make_shared<PwcNetOpticalFlowEstimator>();
+#else
+    throw std::invalid_argument("Optical flow estimator pwc_net is not built because pwc_net package was not found. Use dis instead.");
+#endif
+  }
+  else if (type == "dis")
+  {
+#ifdef SCENE_FLOW_CONSTRUCTOR_HAVE_DIS
+    return std::make_shared<DisOpticalFlowEstimator>(DisOpticalFlowEstimator::loadParameters(private_node_handle));
+#else
+    throw std::invalid_argument("Optical flow estimator dis is not built because OpenCV has neither DIS optical flow (4.0 or later) nor optflow module");
+#endif
+  }
+
+  throw std::invalid_argument("Unknown optical flow estimator: " + type);
+}
+
+} // namespace scene_flow_constructor
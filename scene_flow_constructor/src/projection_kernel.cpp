@@ -0,0 +1,91 @@
+#include "projection_kernel.h"
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace scene_flow_constructor {
+
+ProjectionParams::ProjectionParams(const image_geometry::PinholeCameraModel& camera_model)
+  : fx(camera_model.fx()), fy(camera_model.fy()),
+    cx(camera_model.cx()), cy(camera_model.cy()),
+    tx(camera_model.Tx()), ty(camera_model.Ty())
+{
+}
+
+void projectStaticFlow(const float* points, int count, int u_begin, int v, const ProjectionParams& params, float* flow)
+{
+  int i = 0;
+
+#if defined(__AVX__)
+  const __m256 fx8 = _mm256_set1_ps(params.fx);
+  const __m256 fy8 = _mm256_set1_ps(params.fy);
+  const __m256 tx8 = _mm256_set1_ps(params.tx);
+  const __m256 ty8 = _mm256_set1_ps(params.ty);
+  // Flow is cx - u and cy - v after division
+  const __m256 cx_minus_u8 = _mm256_sub_ps(_mm256_set1_ps(params.cx), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+  const __m256 cy_minus_v8 = _mm256_set1_ps(params.cy - v);
+
+  for (; i + 8 <= count; i += 8)
+  {
+    // Points i..i+3 in lower and i+4..i+7 in upper lane, transposed in each lane
+    const float* p = points + 4 * i;
+    __m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p)), _mm_loadu_ps(p + 16), 1);
+    __m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 4)), _mm_loadu_ps(p + 20), 1);
+    __m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 8)), _mm_loadu_ps(p + 24), 1);
+    __m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 12)), _mm_loadu_ps(p + 28), 1);
+    __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+    __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+    __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+    __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+    __m256 x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+
+    // NaN of invalid points propagates to flow
+    __m256 cx_minus_u = _mm256_sub_ps(cx_minus_u8, _mm256_set1_ps(static_cast<float>(u_begin + i)));
+    __m256 flow_x = _mm256_add_ps(_mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(fx8, x), tx8), z), cx_minus_u);
+    __m256 flow_y = _mm256_add_ps(_mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(fy8, y), ty8), z), cy_minus_v8);
+
+    __m256 lo = _mm256_unpacklo_ps(flow_x, flow_y);
+    __m256 hi = _mm256_unpackhi_ps(flow_x, flow_y);
+    _mm256_storeu_ps(flow + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(flow + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+  }
+#elif defined(__SSE2__)
+  const __m128 fx4 = _mm_set1_ps(params.fx);
+  const __m128 fy4 = _mm_set1_ps(params.fy);
+  const __m128 tx4 = _mm_set1_ps(params.tx);
+  const __m128 ty4 = _mm_set1_ps(params.ty);
+  const __m128 cx_minus_u4 = _mm_sub_ps(_mm_set1_ps(params.cx), _mm_setr_ps(0, 1, 2, 3));
+  const __m128 cy_minus_v4 = _mm_set1_ps(params.cy - v);
+
+  for (; i + 4 <= count; i += 4)
+  {
+    const float* p = points + 4 * i;
+    __m128 x = _mm_loadu_ps(p);
+    __m128 y = _mm_loadu_ps(p + 4);
+    __m128 z = _mm_loadu_ps(p + 8);
+    __m128 w = _mm_loadu_ps(p + 12);
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+
+    // NaN of invalid points propagates to flow
+    __m128 cx_minus_u = _mm_sub_ps(cx_minus_u4, _mm_set1_ps(static_cast<float>(u_begin + i)));
+    __m128 flow_x = _mm_add_ps(_mm_div_ps(_mm_add_ps(_mm_mul_ps(fx4, x), tx4), z), cx_minus_u);
+    __m128 flow_y = _mm_add_ps(_mm_div_ps(_mm_add_ps(_mm_mul_ps(fy4, y), ty4), z), cy_minus_v4);
+
+    _mm_storeu_ps(flow + 2 * i, _mm_unpacklo_ps(flow_x, flow_y));
+    _mm_storeu_ps(flow + 2 * i + 4, _mm_unpackhi_ps(flow_x, flow_y));
+  }
+#endif
+
+  // Scalar fallback and remaining points
+  for (; i < count; i++)
+  {
+    const float* p = points + 4 * i;
+    flow[2 * i] = (params.fx * p[0] + params.tx) / p[2] + (params.cx - (u_begin + i));
+    flow[2 * i + 1] = (params.fy * p[1] + params.ty) / p[2] + (params.cy - v);
+  }
+}
+
+} // namespace scene_flow_constructor
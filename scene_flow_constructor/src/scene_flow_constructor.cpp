@@ -1,27 +1,31 @@
 #include "scene_flow_constructor.h"
+#include "lazy_transformed_cloud.h"
 #include "odometry_params.h"
+#include "projection_kernel.h"
+#include "velocity_point_cloud2.h"
 
 // ROS headers
 #include <image_geometry/stereo_camera_model.h>
 #include <image_transport/camera_common.h>
 #include <sensor_msgs/image_encodings.h>
 #include <sensor_msgs/PointCloud2.h>
-#include <pcl_conversions/pcl_conversions.h>
 #include <tf2_eigen/tf2_eigen.h>
 #include <tf2_geometry_msgs/tf2_geometry_msgs.h>
 
 // Non-ROS headers
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <functional>
 #include <memory>
 #include <stdexcept>
-#include <thread>
+#include <vector>
 
 namespace scene_flow_constructor {
 
-SceneFlowConstructor::SceneFlowConstructor() {
-  ros::NodeHandle node_handle;
-  ros::NodeHandle private_node_handle("~");
+SceneFlowConstructor::SceneFlowConstructor(ros::NodeHandle node_handle, ros::NodeHandle private_node_handle) {
 
   // Load parameters for visual odometry
   ros::NodeHandle visual_odometry_nh(private_node_handle, "visual_odometry");
@@ -32,7 +36,70 @@ SceneFlowConstructor::SceneFlowConstructor() {
   integrated_pose_.setIdentity();
   tf_listener_.reset(new tf2_ros::TransformListener(tf_buffer_));
 
-  sgm_gpu_.reset(new sgm_gpu::SgmGpu(private_node_handle));
+  std::string disparity_estimator_type;
+  private_node_handle.param("disparity_estimator", disparity_estimator_type, defaultDisparityEstimatorType());
+  disparity_estimator_ = createDisparityEstimator(disparity_estimator_type, private_node_handle);
+
+  std::string optical_flow_estimator_type;
+  private_node_handle.param("optical_flow_estimator", optical_flow_estimator_type, defaultOpticalFlowEstimatorType());
+  optical_flow_estimator_ = createOpticalFlowEstimator(optical_flow_estimator_type, private_node_handle);
+
+  int reprojection_threads;
+  private_node_handle.param("reprojection_threads", reprojection_threads, 4);
+  reprojection_thread_pool_.reset(new disparity_image_proc::ThreadPool(std::max(reprojection_threads, 1)));
+
+  // Bounds of frames in the pipeline
+  private_node_handle.param("max_frames_in_flight", max_frames_in_flight_, 2);
+  private_node_handle.param("frame_queue_size", max_waiting_frames_, 1);
+  private_node_handle.param("drop_oldest_frame", drop_oldest_frame_, true);
+  max_frames_in_flight_ = std::max(max_frames_in_flight_, 1);
+  max_waiting_frames_ = std::max(max_waiting_frames_, 0);
+  frames_in_flight_ = 0;
+  next_reprojected_index_ = 0;
+  next_sequence_ = 0;
+  pipeline_stopped_ = false;
+
+  private_node_handle.param("use_fused_kernel", use_fused_kernel_, false);
+  private_node_handle.param("use_lazy_transform", use_lazy_transform_, false);
+  private_node_handle.param("use_sparse_first", use_sparse_first_, false);
+  private_node_handle.param("sparse_first/cell_size", sparse_first_cell_size_, 32);
+  private_node_handle.param("sparse_first/min_outliers", sparse_first_min_outliers_, 2);
+  sparse_first_cell_size_ = std::max(sparse_first_cell_size_, 1);
+  sparse_first_min_outliers_ = std::max(sparse_first_min_outliers_, 1);
+
+  // Camera motion from external odometry on TF
+  std::string camera_motion_source;
+  private_node_handle.param("camera_motion_source", camera_motion_source, std::string("visual_odometry"));
+  if (camera_motion_source == "tf")
+    use_tf_camera_motion_ = true;
+  else if (camera_motion_source == "visual_odometry")
+    use_tf_camera_motion_ = false;
+  else
+    throw std::invalid_argument("Unknown camera motion source: " + camera_motion_source);
+  private_node_handle.param("tf_camera_motion/fixed_frame_id", tf_camera_motion_fixed_frame_id_, odom_frame_id_);
+  double tf_camera_motion_timeout;
+  private_node_handle.param("tf_camera_motion/timeout", tf_camera_motion_timeout, 0.0);
+  tf_camera_motion_timeout_ = ros::Duration(std::max(tf_camera_motion_timeout, 0.0));
+  if (use_tf_camera_motion_ && use_sparse_first_)
+  {
+    ROS_WARN("~use_sparse_first needs feature matches of visual odometry, it's disabled with TF camera motion");
+    use_sparse_first_ = false;
+  }
+  if (use_sparse_first_ && !optical_flow_estimator_->supportsRegions())
+  {
+    // Whole image would be estimated anyway, after waiting for visual odometry
+    ROS_WARN_STREAM("Optical flow estimator " << optical_flow_estimator_type << " can't estimate only in regions, ~use_sparse_first is disabled");
+    use_sparse_first_ = false;
+  }
+
+  // CPU cores to pin threads of disparity, camera motion, optical flow and construction stage
+  std::vector<int> worker_cpus;
+  private_node_handle.param("worker_cpus", worker_cpus, std::vector<int>());
+  worker_cpus.resize(4, -1);
+  disparity_worker_.reset(new StageWorker("sfc_disparity", worker_cpus[0]));
+  camera_motion_worker_.reset(new StageWorker("sfc_cam_motion", worker_cpus[1]));
+  optical_flow_worker_.reset(new StageWorker("sfc_opt_flow", worker_cpus[2]));
+  construct_worker_.reset(new StageWorker("sfc_construct", worker_cpus[3]));
 
   image_transport_.reset(new image_transport::ImageTransport(private_node_handle));
 
@@ -46,6 +113,7 @@ SceneFlowConstructor::SceneFlowConstructor() {
   optflow_pub_ = private_node_handle.advertise<sensor_msgs::Image>("optical_flow", 1);
   pc_with_velocity_pub_ = private_node_handle.advertise<sensor_msgs::PointCloud2>("scene_flow", 1);
   static_flow_pub_ = private_node_handle.advertise<sensor_msgs::Image>("synthetic_optical_flow", 1);
+  sparse_scene_flow_pub_ = private_node_handle.advertise<moving_object_msgs::SparseSceneFlow>("sparse_scene_flow", 1);
 
   // Subscribers
   std::string left_image_topic = node_handle.resolveName("left_image");
@@ -62,28 +130,51 @@ SceneFlowConstructor::SceneFlowConstructor() {
   stereo_synchronizer_->registerCallback(&SceneFlowConstructor::stereoCallback, this);
 }
 
-void SceneFlowConstructor::calculateStaticOpticalFlow(const pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed, cv::Mat &left_static_flow)
+SceneFlowConstructor::~SceneFlowConstructor()
+{
+  // Subscribers are declared before pipeline_mutex_ and the workers, so they would be destroyed after them.
+  // Unsubscribing waits for running callbacks, and no stereoCallback() comes after this.
+  left_image_sub_.unsubscribe();
+  right_image_sub_.unsubscribe();
+  left_caminfo_sub_.unsubscribe();
+  right_caminfo_sub_.unsubscribe();
+
+  {
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    pipeline_stopped_ = true;
+    waiting_frames_.clear();
+  }
+
+  // Frames in flight are finished while estimation stages are still alive
+  construct_worker_.reset();
+  disparity_worker_.reset();
+  camera_motion_worker_.reset();
+  optical_flow_worker_.reset();
+}
+
+void SceneFlowConstructor::calculateStaticOpticalFlow(const pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed, DisparityImageProcessor &disparity_previous, cv::Mat &left_static_flow)
 {
-  left_static_flow = cv::Mat(image_height_, image_width_, CV_32FC2);
+  // Recycled image keeps its memory
+  left_static_flow.create(image_height_, image_width_, CV_32FC2);
+  left_static_flow.setTo(cv::Scalar(std::nanf(""), std::nanf("")));
 
+  ProjectionParams projection_params(*left_cam_model_);
   for (int y = 0; y < image_height_; y++)
   {
-    for (int x = 0; x < image_width_; x++)
+    const uint64_t* mask_row = disparity_previous.getValidityMaskRow(y);
+    const float* points_row = pc_previous_transformed.points[y * image_width_].data;
+    float* flow_row = left_static_flow.ptr<float>(y);
+
+    // Blocks of 64 pixels without valid point are left as NaN.
+    // Other blocks are projected at once, and NaN points give NaN flow.
+    for (int word = 0; word < disparity_previous.getValidityMaskStride(); word++)
     {
-      pcl::PointXYZ pcl_point = pc_previous_transformed.at(x, y);
-      if (std::isnan(pcl_point.x))
-      {
-        left_static_flow.at<cv::Vec2f>(y, x) = cv::Vec2f(std::nanf(""), std::nanf(""));
+      if (mask_row[word] == 0)
         continue;
-      }
 
-      cv::Point3d point_3d;
-      point_3d.x = pcl_point.x;
-      point_3d.y = pcl_point.y;
-      point_3d.z = pcl_point.z;
-      cv::Point2d point_2d = left_cam_model_->project3dToPixel(point_3d);
-      cv::Vec2f static_flow(point_2d.x, point_2d.y);
-      left_static_flow.at<cv::Vec2f>(y, x) = cv::Vec2f(point_2d.x - x, point_2d.y - y);
+      int x_begin = word * 64;
+      int count = std::min(64, image_width_ - x_begin);
+      projectStaticFlow(points_row + 4 * x_begin, count, x_begin, y, projection_params, flow_row + 2 * x_begin);
     }
   }
 }
@@ -93,141 +184,326 @@ void SceneFlowConstructor::construct
   std::shared_ptr<DisparityImageProcessor> disparity_now,
   std::shared_ptr<DisparityImageProcessor> disparity_previous,
   std::shared_ptr<cv_bridge::CvImage> left_flow,
-  geometry_msgs::TransformPtr transform_prev2now
+  geometry_msgs::TransformPtr transform_prev2now,
+  const std::vector<cv::Rect>* candidate_regions
 )
 {
   if (left_flow && optflow_pub_.getNumSubscribers() > 0)
     optflow_pub_.publish(left_flow->toImageMsg());
 
-  // Construct pointcloud from disparity for now frame
+  const cv::Mat* candidate_mask = makeCandidateMask(candidate_regions);
+
+  // Fused kernel doesn't make static optical flow image, so it is used only when nobody subscribes it
+  if (use_fused_kernel_ && static_flow_pub_.getNumSubscribers() == 0)
+  {
+    if (disparity_now && depth_pub_.getNumSubscribers() > 0)
+    {
+      std::shared_ptr<cv::Mat> depth_now = depth_image_arena_.acquire(image_width_, image_height_);
+      disparity_now->toDepthImage(*depth_now);
+      publishDepthImage(depth_pub_, *depth_now, disparity_now->getDisparityMessage().header.stamp);
+    }
+
+    if (disparity_now && disparity_previous && left_flow && transform_prev2now)
+    {
+      std::shared_ptr<sensor_msgs::PointCloud2> velocity_msg = velocity_msg_arena_.acquire(image_width_, image_height_);
+      VelocityPointCloud2 pc_with_velocity(*velocity_msg, image_width_, image_height_);
+      constructVelocityPCFused(*disparity_now, *disparity_previous, *left_flow, *transform_prev2now, pc_with_velocity, candidate_mask);
+
+      if (pc_with_velocity_pub_.getNumSubscribers() > 0)
+        publishPointcloud(pc_with_velocity_pub_, velocity_msg, left_flow->header);
+      if (sparse_scene_flow_pub_.getNumSubscribers() > 0)
+        publishSparseSceneFlow(pc_with_velocity, left_flow->header);
+    }
+    return;
+  }
+
+  // Pointcloud of previous frame is usually reprojected as pc_now of the last construct()
   std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> pc_now, pc_previous;
   if (disparity_previous)
   {
-    pc_previous.reset(new pcl::PointCloud<pcl::PointXYZ>());
-    disparity_previous->toPointCloud(*pc_previous);
+    pc_previous = findReprojectedPointcloud(disparity_previous);
+    if (!pc_previous)
+    {
+      pc_previous = pointcloud_arena_.acquire(image_width_, image_height_);
+      disparity_previous->toPointCloud(*pc_previous, *reprojection_thread_pool_);
+    }
   }
 
   if (disparity_now)
   {
-    pc_now.reset(new pcl::PointCloud<pcl::PointXYZ>());
-    disparity_now->toPointCloud(*pc_now);
+    pc_now = pointcloud_arena_.acquire(image_width_, image_height_);
     if (depth_pub_.getNumSubscribers() > 0)
     {
-      cv::Mat depth_now;
-      disparity_now->toDepthImage(depth_now);
-      publishDepthImage(depth_pub_, depth_now, disparity_now->_disparity_msg.header.stamp);
+      // Pointcloud and depth are constructed in one pass to avoid reprojecting twice
+      std::shared_ptr<cv::Mat> depth_now = depth_image_arena_.acquire(image_width_, image_height_);
+      disparity_now->toPointCloudAndDepthImage(*pc_now, *depth_now, *reprojection_thread_pool_);
+      publishDepthImage(depth_pub_, *depth_now, disparity_now->getDisparityMessage().header.stamp);
+    }
+    else
+    {
+      disparity_now->toPointCloud(*pc_now, *reprojection_thread_pool_);
     }
+    storeReprojectedPointcloud(disparity_now, pc_now);
   }
 
   if (!left_flow)
     return;
 
+  // Transform only points referenced by optical flow, unless whole static optical flow is needed for debug output.
+  // Optical flow of sparse-first mode refers only points around candidate regions.
+  if ((use_lazy_transform_ || candidate_mask) && static_flow_pub_.getNumSubscribers() == 0)
+  {
+    if (pc_now && pc_previous && transform_prev2now)
+    {
+      std::shared_ptr<LazyTransformedCloud::Buffer> lazy_transform_buffer = lazy_transform_arena_.acquire(image_width_, image_height_);
+      LazyTransformedCloud pc_previous_transformed(*pc_previous, *transform_prev2now, *lazy_transform_buffer);
+      ProjectionParams projection_params(*left_cam_model_);
+      auto static_flow_at = [&](const cv::Point2i &pixel)
+      {
+        pcl::PointXYZ point = pc_previous_transformed.at(pixel.x, pixel.y);
+        cv::Vec2f static_flow;
+        projectStaticFlow(point.data, 1, pixel.x, pixel.y, projection_params, static_flow.val);
+        return static_flow;
+      };
+
+      std::shared_ptr<sensor_msgs::PointCloud2> velocity_msg = velocity_msg_arena_.acquire(image_width_, image_height_);
+      VelocityPointCloud2 pc_with_velocity(*velocity_msg, image_width_, image_height_);
+      constructVelocityPC(*pc_now, pc_previous_transformed, *left_flow, static_flow_at, *disparity_now, *disparity_previous, pc_with_velocity, candidate_mask);
+      ROS_DEBUG("%d points of previous frame are transformed", pc_previous_transformed.getTransformedCount());
+
+      if (pc_with_velocity_pub_.getNumSubscribers() > 0)
+        publishPointcloud(pc_with_velocity_pub_, velocity_msg, left_flow->header);
+      if (sparse_scene_flow_pub_.getNumSubscribers() > 0)
+        publishSparseSceneFlow(pc_with_velocity, left_flow->header);
+    }
+    return;
+  }
+
   std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> pc_previous_transformed;
   // Transform previous pointcloud by estimated camera motion
   if (pc_previous && transform_prev2now)
   {
-    pc_previous_transformed.reset(new pcl::PointCloud<pcl::PointXYZ>());
-    transformPCPreviousToNow(*pc_previous, *pc_previous_transformed, *transform_prev2now);
+    pc_previous_transformed = pointcloud_arena_.acquire(image_width_, image_height_);
+    transformPCPreviousToNow(*pc_previous, *disparity_previous, *pc_previous_transformed, *transform_prev2now);
   }
 
   if (pc_now && pc_previous_transformed) 
   {
-    cv_bridge::CvImage left_static_flow(left_flow->header, sensor_msgs::image_encodings::TYPE_32FC2);
-    calculateStaticOpticalFlow(*pc_previous_transformed, left_static_flow.image);
+    std::shared_ptr<cv_bridge::CvImage> left_static_flow = flow_image_arena_.acquire(image_width_, image_height_);
+    left_static_flow->header = left_flow->header;
+    left_static_flow->encoding = sensor_msgs::image_encodings::TYPE_32FC2;
+    calculateStaticOpticalFlow(*pc_previous_transformed, *disparity_previous, left_static_flow->image);
 
-    pcl::PointCloud<pcl::PointXYZVelocity> pc_with_velocity;
-    constructVelocityPC(*pc_now, *pc_previous_transformed, *left_flow, left_static_flow.image, *disparity_now, *disparity_previous, pc_with_velocity);
+    std::shared_ptr<sensor_msgs::PointCloud2> velocity_msg = velocity_msg_arena_.acquire(image_width_, image_height_);
+    VelocityPointCloud2 pc_with_velocity(*velocity_msg, image_width_, image_height_);
+    auto static_flow_at = [&](const cv::Point2i &pixel) { return left_static_flow->image.at<cv::Vec2f>(pixel); };
+    constructVelocityPC(*pc_now, *pc_previous_transformed, *left_flow, static_flow_at, *disparity_now, *disparity_previous, pc_with_velocity, candidate_mask);
 
     if (pc_with_velocity_pub_.getNumSubscribers() > 0)
-      publishPointcloud(pc_with_velocity_pub_, pc_with_velocity, left_flow->header);
+      publishPointcloud(pc_with_velocity_pub_, velocity_msg, left_flow->header);
+    if (sparse_scene_flow_pub_.getNumSubscribers() > 0)
+      publishSparseSceneFlow(pc_with_velocity, left_flow->header);
 
     if (static_flow_pub_.getNumSubscribers() > 0)
-      static_flow_pub_.publish(left_static_flow.toImageMsg());
+      static_flow_pub_.publish(left_static_flow->toImageMsg());
   }
 }
 
-void SceneFlowConstructor::constructVelocityPC
+template <typename PreviousCloudT, typename StaticFlowFunction> void SceneFlowConstructor::constructVelocityPC
 (
   const pcl::PointCloud<pcl::PointXYZ> &pc_now,
-  const pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed,
+  PreviousCloudT &pc_previous_transformed,
   cv_bridge::CvImage &left_flow,
-  cv::Mat &left_static_flow,
+  StaticFlowFunction static_flow_at,
   DisparityImageProcessor &disparity_now,
   DisparityImageProcessor &disparity_previous,
-  pcl::PointCloud<pcl::PointXYZVelocity> &velocity_pc
+  VelocityPointCloud2 &velocity_pc,
+  const cv::Mat* candidate_mask
 )
 {
-  initializeVelocityPC(velocity_pc);
-
-  ros::Time stamp_now = disparity_now._disparity_msg.header.stamp;
-  ros::Time stamp_previous = disparity_previous._disparity_msg.header.stamp;
+  ros::Time stamp_now = disparity_now.getDisparityMessage().header.stamp;
+  ros::Time stamp_previous = disparity_previous.getDisparityMessage().header.stamp;
   ros::Duration time_between_frames = stamp_now - stamp_previous;
 
-  cv::Point2i left_now;
-  for (left_now.y = 0; left_now.y < image_height_; left_now.y++)
+  // Pixels are visited in row-major order, so the indices are sorted
+  dynamic_pixel_indices_.clear();
+  float sparse_dynamic_speed = sparse_dynamic_speed_;
+
+  // Velocity of pixels with invalid disparity is left as NaN
+  disparity_now.forEachValidPixel([&](int u, int v)
   {
-    for (left_now.x = 0; left_now.x < image_width_; left_now.x++)
+    cv::Point2i left_now(u, v);
+    const pcl::PointXYZ &point3d_now = pc_now.at(left_now.x, left_now.y);
+    velocity_pc.setPoint(u, v, point3d_now.x, point3d_now.y, point3d_now.z);
+
+    // Points outside candidate regions of sparse-first mode are static
+    if (candidate_mask && candidate_mask->at<unsigned char>(v, u) == 0)
     {
-      pcl::PointXYZVelocity &point_with_velocity = velocity_pc.at(left_now.x, left_now.y);
-      pcl::PointXYZ point3d_now = pc_now.at(left_now.x, left_now.y);
+      velocity_pc.setVelocity(u, v, 0.0f, 0.0f, 0.0f);
+      return;
+    }
 
-      if (!isValid(point3d_now))
-        continue;
+    cv::Point2i left_previous, right_now, right_previous;
 
-      point_with_velocity.x = point3d_now.x;
-      point_with_velocity.y = point3d_now.y;
-      point_with_velocity.z = point3d_now.z;
+    // Disparity at left_previous is checked by validity mask of previous frame here,
+    // so the point at left_previous is valid
+    if (!getMatchPoints(left_now, left_previous, right_now, right_previous, left_flow, disparity_now, disparity_previous))
+      return;
 
-      cv::Point2i left_previous, right_now, right_previous;
+    pcl::PointXYZ point3d_previous = pc_previous_transformed.at(left_previous.x, left_previous.y);
 
-      if (!getMatchPoints(left_now, left_previous, right_now, right_previous, left_flow, disparity_now, disparity_previous))
-        continue;
+    const cv::Vec2f &flow = left_flow.image.at<cv::Vec2f>(left_now);
+    cv::Vec2f static_flow = static_flow_at(left_now);
+    if (std::isnan(static_flow[0]))
+      return;
 
-      pcl::PointXYZ point3d_previous;
-      point3d_previous = pc_previous_transformed.at(left_previous.x, left_previous.y);
-      if (!isValid(point3d_previous))
-        continue;
+    cv::Vec2f flow_diff = flow - static_flow;
 
-      const cv::Vec2f &flow = left_flow.image.at<cv::Vec2f>(left_now);;
-      cv::Vec2f static_flow = left_static_flow.at<cv::Vec2f>(left_now);
-      if (std::isnan(static_flow[0]))
-        continue;
+    if (std::sqrt(flow_diff.dot(flow_diff)) >= dynamic_flow_diff_)
+    {
+      setDynamicVelocity(u, v,
+        (point3d_now.x - point3d_previous.x) / time_between_frames.toSec(),
+        (point3d_now.y - point3d_previous.y) / time_between_frames.toSec(),
+        (point3d_now.z - point3d_previous.z) / time_between_frames.toSec(),
+        sparse_dynamic_speed, velocity_pc);
+    }
+    else
+    {
+      velocity_pc.setVelocity(u, v, 0.0f, 0.0f, 0.0f);
+    }
+  });
+}
+
+void SceneFlowConstructor::constructVelocityPCFused
+(
+  DisparityImageProcessor &disparity_now,
+  DisparityImageProcessor &disparity_previous,
+  cv_bridge::CvImage &left_flow,
+  const geometry_msgs::Transform &previous_to_now,
+  VelocityPointCloud2 &velocity_pc,
+  const cv::Mat* candidate_mask
+)
+{
+  Eigen::Isometry3d eigen_prev2now = tf2::transformToEigen(previous_to_now);
 
-      cv::Vec2f flow_diff = flow - static_flow;
+  ros::Time stamp_now = disparity_now.getDisparityMessage().header.stamp;
+  ros::Time stamp_previous = disparity_previous.getDisparityMessage().header.stamp;
+  ros::Duration time_between_frames = stamp_now - stamp_previous;
+  ProjectionParams projection_params(*left_cam_model_);
 
-      if (std::sqrt(flow_diff.dot(flow_diff)) >= dynamic_flow_diff_)
-      {
-        point_with_velocity.vx = (point3d_now.x - point3d_previous.x) / time_between_frames.toSec();
-        point_with_velocity.vy = (point3d_now.y - point3d_previous.y) / time_between_frames.toSec();
-        point_with_velocity.vz = (point3d_now.z - point3d_previous.z) / time_between_frames.toSec();
-      }
-      else
-      {
-        point_with_velocity.vx = 0.0;
-        point_with_velocity.vy = 0.0;
-        point_with_velocity.vz = 0.0;
-      }
+  dynamic_pixel_indices_.clear();
+  float sparse_dynamic_speed = sparse_dynamic_speed_;
+
+  // Same result as constructVelocityPC(), but points are reprojected and transformed only when they are used
+  disparity_now.forEachValidPixel([&](int u, int v)
+  {
+    cv::Point2i left_now(u, v);
+    pcl::PointXYZ point3d_now;
+    disparity_now.getPoint3D(u, v, point3d_now);
+    velocity_pc.setPoint(u, v, point3d_now.x, point3d_now.y, point3d_now.z);
+
+    if (candidate_mask && candidate_mask->at<unsigned char>(v, u) == 0)
+    {
+      velocity_pc.setVelocity(u, v, 0.0f, 0.0f, 0.0f);
+      return;
     }
+
+    cv::Point2i left_previous, right_now, right_previous;
+    if (!getMatchPoints(left_now, left_previous, right_now, right_previous, left_flow, disparity_now, disparity_previous))
+      return;
+
+    // Static optical flow at left_now, from previous point at the same pixel
+    pcl::PointXYZ static_point;
+    if (!disparity_previous.getPoint3D(u, v, static_point))
+      return;
+    // Rounded to float like transformed pointcloud
+    Eigen::Vector3f static_transformed = (eigen_prev2now * Eigen::Vector3d(static_point.x, static_point.y, static_point.z)).cast<float>();
+    // Projected in the same way as the lazy and dense paths
+    pcl::PointXYZ static_point_transformed(static_transformed.x(), static_transformed.y(), static_transformed.z());
+    cv::Vec2f static_flow;
+    projectStaticFlow(static_point_transformed.data, 1, u, v, projection_params, static_flow.val);
+
+    const cv::Vec2f &flow = left_flow.image.at<cv::Vec2f>(left_now);
+    cv::Vec2f flow_diff = flow - static_flow;
+
+    if (std::sqrt(flow_diff.dot(flow_diff)) >= dynamic_flow_diff_)
+    {
+      // Valid by getMatchPoints()
+      pcl::PointXYZ point3d_previous;
+      disparity_previous.getPoint3D(left_previous.x, left_previous.y, point3d_previous);
+      Eigen::Vector3f previous_transformed = (eigen_prev2now * Eigen::Vector3d(point3d_previous.x, point3d_previous.y, point3d_previous.z)).cast<float>();
+
+      setDynamicVelocity(u, v,
+        (point3d_now.x - previous_transformed.x()) / time_between_frames.toSec(),
+        (point3d_now.y - previous_transformed.y()) / time_between_frames.toSec(),
+        (point3d_now.z - previous_transformed.z()) / time_between_frames.toSec(),
+        sparse_dynamic_speed, velocity_pc);
+    }
+    else
+    {
+      velocity_pc.setVelocity(u, v, 0.0f, 0.0f, 0.0f);
+    }
+  });
+}
+
+void SceneFlowConstructor::setDynamicVelocity(int u, int v, float vx, float vy, float vz, float sparse_dynamic_speed, VelocityPointCloud2 &velocity_pc)
+{
+  velocity_pc.setVelocity(u, v, vx, vy, vz);
+  // Same comparison as dynamic_speed of scene_flow_clusterer
+  if (std::sqrt(vx * vx + vy * vy + vz * vz) >= sparse_dynamic_speed)
+    dynamic_pixel_indices_.push_back(v * image_width_ + u);
+}
+
+const cv::Mat* SceneFlowConstructor::makeCandidateMask(const std::vector<cv::Rect>* candidate_regions)
+{
+  if (!candidate_regions)
+    return nullptr;
+
+  // Recycled mask keeps its memory
+  candidate_mask_.create(image_height_, image_width_, CV_8UC1);
+  candidate_mask_.setTo(cv::Scalar(0));
+  cv::Rect image_rect(0, 0, image_width_, image_height_);
+  for (const cv::Rect& region : *candidate_regions)
+    candidate_mask_(region & image_rect).setTo(cv::Scalar(255));
+  return &candidate_mask_;
+}
+
+std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> SceneFlowConstructor::findReprojectedPointcloud(const std::shared_ptr<DisparityImageProcessor> &disparity)
+{
+  for (const ReprojectedPointcloud &reprojected : reprojected_pointclouds_)
+  {
+    if (reprojected.disparity == disparity)
+      return reprojected.pointcloud;
   }
+  return nullptr;
 }
 
-void SceneFlowConstructor::estimateCameraMotion(const sensor_msgs::ImageConstPtr& left_image, const sensor_msgs::ImageConstPtr& right_image, const sensor_msgs::CameraInfoConstPtr& left_camera_info, const sensor_msgs::CameraInfoConstPtr& right_camera_info)
+void SceneFlowConstructor::storeReprojectedPointcloud(const std::shared_ptr<DisparityImageProcessor> &disparity, const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &pointcloud)
+{
+  // Overwrite the oldest entry
+  ReprojectedPointcloud &oldest = reprojected_pointclouds_[next_reprojected_index_];
+  oldest.disparity = disparity;
+  oldest.pointcloud = pointcloud;
+  next_reprojected_index_ = (next_reprojected_index_ + 1) % reprojected_pointclouds_.size();
+}
+
+geometry_msgs::TransformPtr SceneFlowConstructor::estimateCameraMotion(MonoImage& left_image, MonoImage& right_image, const sensor_msgs::CameraInfoConstPtr& left_camera_info, const sensor_msgs::CameraInfoConstPtr& right_camera_info)
 {
   if (!visual_odometer_)
     initializeOdometer(*left_camera_info, *right_camera_info);
 
-  // convert images
-  cv_bridge::CvImageConstPtr cv_left = cv_bridge::toCvCopy(left_image, sensor_msgs::image_encodings::MONO8);
-  cv_bridge::CvImageConstPtr cv_right = cv_bridge::toCvCopy(right_image, sensor_msgs::image_encodings::MONO8);
+  // Mono images shared with other stages. libviso2 copies them into its own buffers and doesn't modify them.
+  const cv::Mat &left_mono = left_image.mono();
+  const cv::Mat &right_mono = right_image.mono();
 
   // assertion for input images
-  ROS_ASSERT(cv_left->image.step[0] == cv_right->image.step[0]);
-  ROS_ASSERT(cv_left->image.rows == cv_right->image.rows);
-  ROS_ASSERT(cv_left->image.cols == cv_left->image.cols);
+  ROS_ASSERT(left_mono.step[0] == right_mono.step[0]);
+  ROS_ASSERT(left_mono.rows == right_mono.rows);
+  ROS_ASSERT(left_mono.cols == right_mono.cols);
 
   // estimate camera motion
-  int32_t dims[] = {cv_left->image.cols, cv_left->image.rows, static_cast<int32_t>(cv_left->image.step[0])};
-  bool success = visual_odometer_->process(cv_left->image.data, cv_right->image.data, dims);
+  int32_t dims[] = {left_mono.cols, left_mono.rows, static_cast<int32_t>(left_mono.step[0])};
+  bool success = visual_odometer_->process(left_mono.data, right_mono.data, dims);
 
   if (success)
   {
@@ -243,65 +519,154 @@ void SceneFlowConstructor::estimateCameraMotion(const sensor_msgs::ImageConstPtr
     tf2::Vector3 camera_translation(camera_motion.val[0][3], camera_motion.val[1][3], camera_motion.val[2][3]);
     tf2::Transform tf2_camera_motion(camera_rotation, camera_translation);
 
-    integrateAndBroadcastTF(tf2_camera_motion.inverse(), left_image->header.stamp);
+    integrateAndBroadcastTF(tf2_camera_motion.inverse(), left_image.message()->header.stamp);
 
-    transform_prev2now_.reset(new geometry_msgs::Transform());
-    *transform_prev2now_ = tf2::toMsg(tf2_camera_motion);
+    geometry_msgs::TransformPtr transform_prev2now(new geometry_msgs::Transform());
+    *transform_prev2now = tf2::toMsg(tf2_camera_motion);
+    return transform_prev2now;
   }
   else
   {
-    transform_prev2now_.reset();
-    ROS_ERROR_STREAM("Visual odometry is failed\nInput timestamp: " << left_image->header.stamp);
+    ROS_ERROR_STREAM("Visual odometry is failed\nInput timestamp: " << left_image.message()->header.stamp);
+    return nullptr;
+  }
+}
+
+geometry_msgs::TransformPtr SceneFlowConstructor::lookupCameraMotion(const std_msgs::Header& previous_header, const std_msgs::Header& header)
+{
+  // Transform of points from camera at previous stamp to camera at now stamp, same as libviso2's motion
+  // TF lagging behind the images skips the frame instead of blocking the camera motion stage,
+  // which would delay all following frames too
+  std::string error_msg;
+  if (!tf_buffer_.canTransform(
+        header.frame_id, header.stamp,
+        previous_header.frame_id, previous_header.stamp,
+        tf_camera_motion_fixed_frame_id_, tf_camera_motion_timeout_, &error_msg))
+  {
+    ROS_WARN_STREAM_THROTTLE(1.0, "Camera motion isn't available on TF, frame is skipped: " << error_msg << "\nInput timestamp: " << header.stamp);
+    return nullptr;
+  }
+
+  geometry_msgs::TransformStamped previous_to_now;
+  try
+  {
+    previous_to_now = tf_buffer_.lookupTransform(
+      header.frame_id, header.stamp,
+      previous_header.frame_id, previous_header.stamp,
+      tf_camera_motion_fixed_frame_id_
+    );
+  }
+  catch (const tf2::TransformException& e)
+  {
+    ROS_ERROR_STREAM("Failed to look up camera motion: " << e.what() << "\nInput timestamp: " << header.stamp);
+    return nullptr;
   }
+
+  geometry_msgs::TransformPtr transform_prev2now(new geometry_msgs::Transform(previous_to_now.transform));
+  return transform_prev2now;
 }
 
-void SceneFlowConstructor::estimateDisparity
+std::shared_ptr<std::vector<cv::Rect>> SceneFlowConstructor::findCandidateRegions(int width, int height)
+{
+  std::vector<Matcher::p_match> matches = visual_odometer_->getMatches();
+  std::vector<bool> is_inlier(matches.size(), false);
+  for (int32_t inlier_index : visual_odometer_->getInlierIndices())
+    is_inlier[inlier_index] = true;
+
+  // Features which don't follow camera motion are on moving objects or mismatched
+  int cell_size = sparse_first_cell_size_;
+  cv::Mat outlier_count = cv::Mat::zeros((height + cell_size - 1) / cell_size, (width + cell_size - 1) / cell_size, CV_32SC1);
+  for (size_t i = 0; i < matches.size(); i++)
+  {
+    if (is_inlier[i])
+      continue;
+
+    int cell_x = std::min(std::max(static_cast<int>(matches[i].u1c), 0), width - 1) / cell_size;
+    int cell_y = std::min(std::max(static_cast<int>(matches[i].v1c), 0), height - 1) / cell_size;
+    outlier_count.at<int32_t>(cell_y, cell_x)++;
+  }
+
+  // Single mismatches are ignored, and margin of one cell covers parts of objects without features
+  cv::Mat candidate_cells = outlier_count >= sparse_first_min_outliers_;
+  cv::dilate(candidate_cells, candidate_cells, cv::Mat());
+
+  cv::Mat labels, stats, centroids;
+  int number_of_labels = cv::connectedComponentsWithStats(candidate_cells, labels, stats, centroids, 8, CV_32S);
+
+  std::vector<cv::Rect> bounds(number_of_labels);
+  // Label 0 is background
+  for (int label = 1; label < number_of_labels; label++)
+  {
+    cv::Rect cells(stats.at<int32_t>(label, cv::CC_STAT_LEFT), stats.at<int32_t>(label, cv::CC_STAT_TOP),
+      stats.at<int32_t>(label, cv::CC_STAT_WIDTH), stats.at<int32_t>(label, cv::CC_STAT_HEIGHT));
+    bounds[label] = cv::Rect(cells.x * cell_size, cells.y * cell_size, cells.width * cell_size, cells.height * cell_size);
+  }
+
+  // Fast objects move further than padding of optical flow between frames,
+  // so regions are grown to cover previous positions of their outlier features with the same margin
+  for (size_t i = 0; i < matches.size(); i++)
+  {
+    if (is_inlier[i])
+      continue;
+
+    int cell_x = std::min(std::max(static_cast<int>(matches[i].u1c), 0), width - 1) / cell_size;
+    int cell_y = std::min(std::max(static_cast<int>(matches[i].v1c), 0), height - 1) / cell_size;
+    int label = labels.at<int32_t>(cell_y, cell_x);
+    if (label == 0)
+      continue;
+
+    cv::Rect previous_cells(static_cast<int>(matches[i].u1p) / cell_size - 1, static_cast<int>(matches[i].v1p) / cell_size - 1, 3, 3);
+    bounds[label] |= cv::Rect(previous_cells.x * cell_size, previous_cells.y * cell_size, previous_cells.width * cell_size, previous_cells.height * cell_size);
+  }
+
+  std::shared_ptr<std::vector<cv::Rect>> regions(new std::vector<cv::Rect>());
+  cv::Rect image_rect(0, 0, width, height);
+  for (int label = 1; label < number_of_labels; label++)
+    regions->push_back(bounds[label] & image_rect);
+
+  ROS_DEBUG("%d of %d features are outliers, %d candidate regions", static_cast<int>(matches.size() - visual_odometer_->getNumberOfInliers()), static_cast<int>(matches.size()), static_cast<int>(regions->size()));
+  return regions;
+}
+
+std::shared_ptr<DisparityImageProcessor> SceneFlowConstructor::estimateDisparity
 (
-  const sensor_msgs::ImageConstPtr& left_image, 
-  const sensor_msgs::ImageConstPtr& right_image, 
+  MonoImage& left_image,
+  MonoImage& right_image,
   const sensor_msgs::CameraInfoConstPtr& left_camera_info, 
   const sensor_msgs::CameraInfoConstPtr& right_camera_info
 )
 {
-  stereo_msgs::DisparityImage disparity;
-  bool success = sgm_gpu_->computeDisparity(*left_image, *right_image, 
-    *left_camera_info, *right_camera_info, disparity);
+  // Disparity is handed to the processor without copy, in fixed-point if the backend outputs it
+  std::shared_ptr<DisparityImageProcessor> disparity = disparity_estimator_->estimateProcessor(left_image, right_image,
+    left_camera_info, right_camera_info);
 
-  if (success)
-    disparity_now_.reset(new DisparityImageProcessor(disparity, *left_camera_info));
-  else
-  {
-    disparity_now_.reset();
-    ROS_ERROR_STREAM("Disparity estimation is failed\nInput timestamp: " << left_image->header.stamp);
-  }
+  if (!disparity)
+    ROS_ERROR_STREAM("Disparity estimation is failed\nInput timestamp: " << left_image.message()->header.stamp);
+  return disparity;
 }
 
-void SceneFlowConstructor::estimateOpticalFlow(const sensor_msgs::ImageConstPtr& left_image)
+std::shared_ptr<cv_bridge::CvImage> SceneFlowConstructor::estimateOpticalFlow(MonoImage& previous_left_image, MonoImage& left_image, const std::vector<cv::Rect>* regions)
 {
-  left_flow_.reset(new cv_bridge::CvImage(left_image->header, sensor_msgs::image_encodings::TYPE_32FC2));
-  bool success = pwc_net_.estimateOpticalFlow(*previous_left_image_, *left_image, left_flow_->image);
+  const sensor_msgs::Image& left_msg = *left_image.message();
+  std::shared_ptr<cv_bridge::CvImage> left_flow = flow_image_arena_.acquire(left_msg.width, left_msg.height);
+  left_flow->header = left_msg.header;
+  left_flow->encoding = sensor_msgs::image_encodings::TYPE_32FC2;
+  bool success;
+  if (regions)
+    success = optical_flow_estimator_->estimateInRegions(previous_left_image, left_image, *regions, left_flow->image);
+  else
+    success = optical_flow_estimator_->estimate(previous_left_image, left_image, left_flow->image);
 
   if (!success)
   {
-    left_flow_.reset();
     ROS_ERROR_STREAM("Optical flow estimation is failed\nInput timestamp: " 
-      << previous_left_image_->header.stamp << " and " << left_image->header.stamp);
+      << previous_left_image.message()->header.stamp << " and " << left_msg.header.stamp);
+    return nullptr;
   }
+  return left_flow;
 }
   
 
-void SceneFlowConstructor::initializeVelocityPC(pcl::PointCloud<pcl::PointXYZVelocity> &velocity_pc)
-{
-  pcl::PointXYZVelocity default_value;
-  default_value.x = std::nanf("");
-  default_value.y = std::nanf("");
-  default_value.z = std::nanf("");
-  default_value.vx = std::nanf("");
-  default_value.vy = std::nanf("");
-  default_value.vz = std::nanf("");
-  velocity_pc = pcl::PointCloud<pcl::PointXYZVelocity>(image_width_, image_height_, default_value);
-}
-
 void SceneFlowConstructor::initializeOdometer(const sensor_msgs::CameraInfo& l_info_msg, const sensor_msgs::CameraInfo& r_info_msg)
 {
   // read calibration info from camera info message
@@ -348,23 +713,44 @@ void SceneFlowConstructor::integrateAndBroadcastTF(const tf2::Transform& delta_t
   tf_broadcaster_.sendTransform(base_transform_msg);
 }
 
-template <typename PointT> void SceneFlowConstructor::publishPointcloud
+void SceneFlowConstructor::publishPointcloud
 (
   const ros::Publisher &publisher,
-  const pcl::PointCloud<PointT> &pointcloud,
+  const std::shared_ptr<sensor_msgs::PointCloud2> &pointcloud_msg,
   const std_msgs::Header &header
 )
 {
-  sensor_msgs::PointCloud2 pointcloud_msg;
-  pcl::toROSMsg(pointcloud, pointcloud_msg);
-  pointcloud_msg.header = header;
-  publisher.publish(pointcloud_msg);
+  pointcloud_msg->header = header;
+
+  // Subscribers in the same nodelet manager receive the message itself without serialization.
+  // The arena doesn't recycle it until they release it, because the deleter holds pointcloud_msg.
+  sensor_msgs::PointCloud2ConstPtr shared_msg(pointcloud_msg.get(), [pointcloud_msg](const sensor_msgs::PointCloud2*) {});
+  publisher.publish(shared_msg);
 }
 
-void SceneFlowConstructor::stereoCallback(const sensor_msgs::ImageConstPtr& left_image, const sensor_msgs::ImageConstPtr& right_image, const sensor_msgs::CameraInfoConstPtr& left_camera_info, const sensor_msgs::CameraInfoConstPtr& right_camera_info)
+void SceneFlowConstructor::publishSparseSceneFlow(VelocityPointCloud2 &velocity_pc, const std_msgs::Header &header)
 {
-  ros::WallTime start_process = ros::WallTime::now();
+  moving_object_msgs::SparseSceneFlowPtr sparse_msg(new moving_object_msgs::SparseSceneFlow());
+  sparse_msg->header = header;
+  sparse_msg->width = image_width_;
+  sparse_msg->height = image_height_;
 
+  // Indices are collected by the velocity pass instead of scanning all pixels again
+  sparse_msg->pixel_indices = dynamic_pixel_indices_;
+
+  VelocityPointCloud2 sparse_points(sparse_msg->points, sparse_msg->pixel_indices.size(), 1);
+  for (size_t i = 0; i < sparse_msg->pixel_indices.size(); i++)
+  {
+    uint32_t pixel_index = sparse_msg->pixel_indices[i];
+    sparse_points.copyPoint(i, 0, velocity_pc, pixel_index % image_width_, pixel_index / image_width_);
+  }
+  sparse_msg->points.header = header;
+
+  sparse_scene_flow_pub_.publish(sparse_msg);
+}
+
+void SceneFlowConstructor::stereoCallback(const sensor_msgs::ImageConstPtr& left_image, const sensor_msgs::ImageConstPtr& right_image, const sensor_msgs::CameraInfoConstPtr& left_camera_info, const sensor_msgs::CameraInfoConstPtr& right_camera_info)
+{
   if (!left_cam_model_)
   {
     left_cam_model_.reset(new image_geometry::PinholeCameraModel());
@@ -374,58 +760,143 @@ void SceneFlowConstructor::stereoCallback(const sensor_msgs::ImageConstPtr& left
     image_height_ = left_image->height;
   }
 
-  ROS_DEBUG("Get disparity, optical flow and camera motion by calling external services on separate threads");
-  std::thread disparity_thread(&SceneFlowConstructor::estimateDisparity, this, left_image, right_image, left_camera_info, right_camera_info);
-  std::thread cammotion_thread(&SceneFlowConstructor::estimateCameraMotion, this, left_image, right_image, left_camera_info, right_camera_info);
-  if (previous_left_image_)
+  std::shared_ptr<Frame> frame(new Frame());
+  frame->received_time = ros::WallTime::now();
+  frame->left_image = std::make_shared<MonoImage>(left_image);
+  frame->right_image = std::make_shared<MonoImage>(right_image);
+  frame->left_camera_info = left_camera_info;
+  frame->right_camera_info = right_camera_info;
+
+  std::lock_guard<std::mutex> lock(pipeline_mutex_);
+  if (pipeline_stopped_)
+    return;
+
+  waiting_frames_.push_back(frame);
+  admitWaitingFrames();
+
+  // Frames which can't enter the pipeline wait in bounded queue
+  while (waiting_frames_.size() > static_cast<size_t>(max_waiting_frames_))
   {
-    std::thread optflow_thread(&SceneFlowConstructor::estimateOpticalFlow, this, left_image);
-    optflow_thread.join();
+    std::shared_ptr<Frame> dropped_frame;
+    if (drop_oldest_frame_)
+    {
+      dropped_frame = waiting_frames_.front();
+      waiting_frames_.pop_front();
+    }
+    else
+    {
+      dropped_frame = waiting_frames_.back();
+      waiting_frames_.pop_back();
+    }
+    ROS_WARN_STREAM_THROTTLE(1.0, "Pipeline is full, frame is dropped\nInput timestamp: " << dropped_frame->left_image->message()->header.stamp);
   }
-  disparity_thread.join();
-  cammotion_thread.join();
-  ROS_DEBUG("Threads for disparity, optical flow and camera motion are finished");
+}
+
+void SceneFlowConstructor::admitWaitingFrames()
+{
+  while (!pipeline_stopped_ && frames_in_flight_ < max_frames_in_flight_ && !waiting_frames_.empty())
+  {
+    std::shared_ptr<Frame> frame = waiting_frames_.front();
+    waiting_frames_.pop_front();
+    frames_in_flight_++;
+
+    frame->sequence = next_sequence_++;
+    frame->previous_left_image = previous_left_image_;
+    previous_left_image_ = frame->left_image;
 
-  if (construct_thread_.joinable())
-    construct_thread_.join();
+    // Every stage processes frames in order of admission,
+    // so visual odometry and construct() see consecutive frames
+    frame->disparity_finished = disparity_worker_->push([this, frame]
+    {
+      frame->disparity = estimateDisparity(*frame->left_image, *frame->right_image, frame->left_camera_info, frame->right_camera_info);
+    }).share();
+    frame->camera_motion_finished = camera_motion_worker_->push([this, frame]
+    {
+      if (use_tf_camera_motion_)
+      {
+        if (frame->previous_left_image)
+          frame->transform_prev2now = lookupCameraMotion(frame->previous_left_image->message()->header, frame->left_image->message()->header);
+        return;
+      }
+      frame->transform_prev2now = estimateCameraMotion(*frame->left_image, *frame->right_image, frame->left_camera_info, frame->right_camera_info);
+      if (use_sparse_first_ && frame->transform_prev2now)
+        frame->candidate_regions = findCandidateRegions(frame->left_image->message()->width, frame->left_image->message()->height);
+    }).share();
+    if (frame->previous_left_image)
+    {
+      frame->optical_flow_finished = optical_flow_worker_->push([this, frame]
+      {
+        // Candidate regions are found by visual odometry of this frame
+        if (use_sparse_first_)
+          frame->camera_motion_finished.wait();
+        frame->left_flow = estimateOpticalFlow(*frame->previous_left_image, *frame->left_image, frame->candidate_regions.get());
+      }).share();
+    }
+    construct_worker_->push([this, frame] { constructFrame(frame); });
+  }
+}
 
-  construct_thread_ = std::thread(&SceneFlowConstructor::construct, this, disparity_now_, disparity_previous_, left_flow_, transform_prev2now_);
+void SceneFlowConstructor::constructFrame(std::shared_ptr<Frame> frame)
+{
+  // Every stage must be finished before results of the frame are read, even if one of them has thrown
+  if (frame->optical_flow_finished.valid())
+    frame->optical_flow_finished.wait();
+  frame->disparity_finished.wait();
+  frame->camera_motion_finished.wait();
+
+  // Disparity whose estimation has thrown isn't used as previous disparity of the next frame
+  std::shared_ptr<DisparityImageProcessor> disparity_now;
+  try
+  {
+    frame->disparity_finished.get();
+    disparity_now = frame->disparity;
+    if (frame->optical_flow_finished.valid())
+      frame->optical_flow_finished.get();
+    frame->camera_motion_finished.get();
+    ROS_DEBUG("Disparity, optical flow and camera motion of frame %lu are finished", static_cast<unsigned long>(frame->sequence));
+
+    construct(frame->disparity, disparity_previous_, frame->left_flow, frame->transform_prev2now, frame->candidate_regions.get());
+  }
+  catch (const std::exception& e)
+  {
+    ROS_ERROR_STREAM("Failed to process frame " << frame->sequence << ": " << e.what());
+  }
+  disparity_previous_ = disparity_now;
 
-  ros::WallDuration process_time = ros::WallTime::now() - start_process;
+  ros::WallDuration process_time = ros::WallTime::now() - frame->received_time;
   ROS_INFO("process time: %f", process_time.toSec());
 
-  previous_left_image_ = left_image;
-  disparity_previous_ = disparity_now_;
+  // Next frame can enter the pipeline
+  std::lock_guard<std::mutex> lock(pipeline_mutex_);
+  frames_in_flight_--;
+  admitWaitingFrames();
 }
 
 void SceneFlowConstructor::reconfigureCB(scene_flow_constructor::SceneFlowConstructorConfig& config, uint32_t level)
 {
-  ROS_INFO("Reconfigure Request: dynamic_flow_diff = %d, max_color_velocity = %f", config.dynamic_flow_diff, config.max_color_velocity);
+  ROS_INFO("Reconfigure Request: dynamic_flow_diff = %d, max_color_velocity = %f, sparse_dynamic_speed = %f", config.dynamic_flow_diff, config.max_color_velocity, config.sparse_dynamic_speed);
 
   dynamic_flow_diff_  = config.dynamic_flow_diff;
   max_color_velocity_ = config.max_color_velocity;
+  sparse_dynamic_speed_ = config.sparse_dynamic_speed;
 }
 
-void SceneFlowConstructor::transformPCPreviousToNow(const pcl::PointCloud<pcl::PointXYZ> &pc_previous, pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed, const geometry_msgs::Transform &previous_to_now)
+void SceneFlowConstructor::transformPCPreviousToNow(const pcl::PointCloud<pcl::PointXYZ> &pc_previous, DisparityImageProcessor &disparity_previous, pcl::PointCloud<pcl::PointXYZ> &pc_previous_transformed, const geometry_msgs::Transform &previous_to_now)
 {
   Eigen::Isometry3d eigen_prev2now = tf2::transformToEigen(previous_to_now);
 
-  pc_previous_transformed = pcl::PointCloud<pcl::PointXYZ>(image_width_, image_height_);
-  for (int u = 0; u < image_width_; u++)
+  pcl::PointXYZ invalid_point(std::nanf(""), std::nanf(""), std::nanf(""));
+  pc_previous_transformed.width = image_width_;
+  pc_previous_transformed.height = image_height_;
+  pc_previous_transformed.is_dense = false;
+  pc_previous_transformed.points.resize(image_width_ * image_height_);
+  std::fill(pc_previous_transformed.points.begin(), pc_previous_transformed.points.end(), invalid_point);
+  disparity_previous.forEachValidPixel([&](int u, int v)
   {
-    for (int v = 0; v < image_height_; v++)
-    {
-      const pcl::PointXYZ &point = pc_previous.at(u, v);
-      if (std::isnan(point.x))
-      {
-        pc_previous_transformed.at(u, v) = pc_previous.at(u, v);
-        continue;
-      }
-
-      Eigen::Vector3d eigen_transformed = eigen_prev2now * Eigen::Vector3d(point.x, point.y, point.z);
-      pc_previous_transformed.at(u, v) = pcl::PointXYZ(eigen_transformed.x(), eigen_transformed.y(), eigen_transformed.z());
-    }
-  }
+    const pcl::PointXYZ &point = pc_previous.at(u, v);
+    Eigen::Vector3d eigen_transformed = eigen_prev2now * Eigen::Vector3d(point.x, point.y, point.z);
+    pc_previous_transformed.at(u, v) = pcl::PointXYZ(eigen_transformed.x(), eigen_transformed.y(), eigen_transformed.z());
+  });
 }
 
 void SceneFlowConstructor::publishDepthImage(ros::Publisher& depth_pub, cv::Mat& depth_image, ros::Time timestamp)
@@ -3,7 +3,7 @@
 int main(int argc, char **argv)
 {
   ros::init(argc, argv, "scene_flow_constructor");
-  scene_flow_constructor::SceneFlowConstructor scene_flow_constructor;
+  scene_flow_constructor::SceneFlowConstructor scene_flow_constructor(ros::NodeHandle(), ros::NodeHandle("~"));
   ros::spin();
 
   return 0;
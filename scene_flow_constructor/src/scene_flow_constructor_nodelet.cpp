@@ -0,0 +1,28 @@
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "scene_flow_constructor.h"
+
+#include <memory>
+
+namespace scene_flow_constructor {
+
+/**
+ * \brief Nodelet version of scene_flow_constructor node
+ *
+ * Loaded into the same manager as scene_flow_clusterer, scene flow is passed without serialization.
+ */
+class SceneFlowConstructorNodelet : public nodelet::Nodelet {
+public:
+  virtual void onInit()
+  {
+    scene_flow_constructor_.reset(new SceneFlowConstructor(getNodeHandle(), getPrivateNodeHandle()));
+  }
+
+private:
+  std::shared_ptr<SceneFlowConstructor> scene_flow_constructor_;
+};
+
+} // namespace scene_flow_constructor
+
+PLUGINLIB_EXPORT_CLASS(scene_flow_constructor::SceneFlowConstructorNodelet, nodelet::Nodelet)
@@ -0,0 +1,139 @@
+#include "sgbm_disparity_estimator.h"
+
+#include <cv_bridge/cv_bridge.h>
+#include <image_geometry/stereo_camera_model.h>
+#include <sensor_msgs/image_encodings.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace scene_flow_constructor {
+
+SgbmDisparityEstimator::SgbmDisparityEstimator(const Parameters& parameters)
+{
+  int num_disparities = std::max((parameters.num_disparities + 15) / 16 * 16, 16);
+  int block_size = std::max(parameters.block_size | 1, 1);
+  int p1 = parameters.p1 >= 0 ? parameters.p1 : 8 * block_size * block_size;
+  int p2 = parameters.p2 >= 0 ? parameters.p2 : 32 * block_size * block_size;
+
+  stereo_matcher_ = cv::StereoSGBM::create(
+    parameters.min_disparity, num_disparities, block_size, p1, p2,
+    parameters.disp12_max_diff, parameters.pre_filter_cap, parameters.uniqueness_ratio,
+    parameters.speckle_window_size, parameters.speckle_range, cv::StereoSGBM::MODE_SGBM_3WAY);
+}
+
+SgbmDisparityEstimator::Parameters SgbmDisparityEstimator::loadParameters(ros::NodeHandle private_node_handle)
+{
+  ros::NodeHandle sgbm_nh(private_node_handle, "sgbm");
+  Parameters parameters;
+  sgbm_nh.param("min_disparity", parameters.min_disparity, parameters.min_disparity);
+  sgbm_nh.param("num_disparities", parameters.num_disparities, parameters.num_disparities);
+  sgbm_nh.param("block_size", parameters.block_size, parameters.block_size);
+  sgbm_nh.param("p1", parameters.p1, parameters.p1);
+  sgbm_nh.param("p2", parameters.p2, parameters.p2);
+  sgbm_nh.param("disp12_max_diff", parameters.disp12_max_diff, parameters.disp12_max_diff);
+  sgbm_nh.param("pre_filter_cap", parameters.pre_filter_cap, parameters.pre_filter_cap);
+  sgbm_nh.param("uniqueness_ratio", parameters.uniqueness_ratio, parameters.uniqueness_ratio);
+  sgbm_nh.param("speckle_window_size", parameters.speckle_window_size, parameters.speckle_window_size);
+  sgbm_nh.param("speckle_range", parameters.speckle_range, parameters.speckle_range);
+  return parameters;
+}
+
+bool SgbmDisparityEstimator::estimate
+(
+  MonoImage& left_image,
+  MonoImage& right_image,
+  const sensor_msgs::CameraInfo& left_camera_info,
+  const sensor_msgs::CameraInfo& right_camera_info,
+  stereo_msgs::DisparityImage& disparity
+)
+{
+  cv::Mat fixed_point_disparity;
+  if (!estimateFixedPoint(left_image, right_image, left_camera_info, right_camera_info, fixed_point_disparity, disparity))
+    return false;
+
+  // Float disparity is on steps of delta_d, because the offset is already added in fixed-point
+  cv_bridge::CvImage disparity_image(disparity.header, sensor_msgs::image_encodings::TYPE_32FC1);
+  fixed_point_disparity.convertTo(disparity_image.image, CV_32F, disparity.delta_d);
+  disparity_image.toImageMsg(disparity.image);
+
+  return true;
+}
+
+std::shared_ptr<DisparityImageProcessor> SgbmDisparityEstimator::estimateProcessor
+(
+  MonoImage& left_image,
+  MonoImage& right_image,
+  const sensor_msgs::CameraInfoConstPtr& left_camera_info,
+  const sensor_msgs::CameraInfoConstPtr& right_camera_info
+)
+{
+  stereo_msgs::DisparityImagePtr disparity_info(new stereo_msgs::DisparityImage());
+  cv::Mat fixed_point_disparity;
+  if (!estimateFixedPoint(left_image, right_image, *left_camera_info, *right_camera_info, fixed_point_disparity, *disparity_info))
+    return nullptr;
+
+  return std::make_shared<DisparityImageProcessor>(disparity_info, fixed_point_disparity, cv::StereoMatcher::DISP_SHIFT, left_camera_info);
+}
+
+bool SgbmDisparityEstimator::estimateFixedPoint
+(
+  MonoImage& left_image,
+  MonoImage& right_image,
+  const sensor_msgs::CameraInfo& left_camera_info,
+  const sensor_msgs::CameraInfo& right_camera_info,
+  cv::Mat& fixed_point_disparity,
+  stereo_msgs::DisparityImage& disparity_info
+)
+{
+  cv::Mat left_mono, right_mono;
+  try
+  {
+    left_mono = left_image.mono();
+    right_mono = right_image.mono();
+  }
+  catch (const cv_bridge::Exception& e)
+  {
+    ROS_ERROR_STREAM("Failed to convert stereo images: " << e.what());
+    return false;
+  }
+
+  if (left_mono.size() != right_mono.size())
+  {
+    ROS_ERROR_STREAM("Size of left and right image are different");
+    return false;
+  }
+
+  stereo_matcher_->compute(left_mono, right_mono, disparity16_);
+
+  image_geometry::StereoCameraModel model;
+  model.fromCameraInfo(left_camera_info, right_camera_info);
+
+  // Same offset as stereo_image_proc, rounded to a step of fixed-point disparity.
+  // Disparity range is shifted by the same offset, so invalid pixels stay smaller than min_disparity.
+  // fixed_point_disparity is newly allocated, because the processor shares it without copy.
+  static const double inv_dpp = 1.0 / cv::StereoMatcher::DISP_SCALE;
+  int offset = static_cast<int>(std::round(-(model.left().cx() - model.right().cx()) * cv::StereoMatcher::DISP_SCALE));
+  fixed_point_disparity = cv::Mat();
+  disparity16_.convertTo(fixed_point_disparity, CV_16S, 1.0, offset);
+
+  const std_msgs::Header& header = left_image.message()->header;
+  disparity_info.header = header;
+  disparity_info.f = model.right().fx();
+  disparity_info.T = model.baseline();
+  disparity_info.min_disparity = stereo_matcher_->getMinDisparity() + offset * inv_dpp;
+  disparity_info.max_disparity = stereo_matcher_->getMinDisparity() + stereo_matcher_->getNumDisparities() - 1 + offset * inv_dpp;
+  disparity_info.delta_d = inv_dpp;
+
+  // Left border isn't matched because right image doesn't contain it
+  int border = stereo_matcher_->getBlockSize() / 2;
+  int left_margin = stereo_matcher_->getMinDisparity() + stereo_matcher_->getNumDisparities() - 1 + border;
+  disparity_info.valid_window.x_offset = std::min(left_margin, disparity16_.cols);
+  disparity_info.valid_window.y_offset = std::min(border, disparity16_.rows);
+  disparity_info.valid_window.width = std::max(disparity16_.cols - left_margin - border, 0);
+  disparity_info.valid_window.height = std::max(disparity16_.rows - 2 * border, 0);
+
+  return true;
+}
+
+} // namespace scene_flow_constructor
@@ -0,0 +1,80 @@
+#include "stage_worker.h"
+
+#include <ros/ros.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace scene_flow_constructor {
+
+StageWorker::StageWorker(const std::string& name, int cpu) : name_(name), stop_(false)
+{
+  thread_ = std::thread(&StageWorker::workerLoop, this);
+
+  // Linux limits thread name to 15 characters
+  pthread_setname_np(thread_.native_handle(), name_.substr(0, 15).c_str());
+
+  if (cpu >= 0)
+    pinToCpu(cpu);
+}
+
+StageWorker::~StageWorker()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  condition_.notify_all();
+  thread_.join();
+}
+
+std::future<void> StageWorker::push(std::function<void()> task)
+{
+  std::packaged_task<void()> packaged_task(std::move(task));
+  std::future<void> future = packaged_task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(packaged_task));
+  }
+  condition_.notify_one();
+  return future;
+}
+
+void StageWorker::pinToCpu(int cpu)
+{
+  if (cpu >= CPU_SETSIZE)
+  {
+    ROS_WARN_STREAM("CPU " << cpu << " for " << name_ << " is out of range");
+    return;
+  }
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+
+  int error = pthread_setaffinity_np(thread_.native_handle(), sizeof(cpu_set_t), &cpu_set);
+  if (error != 0)
+    ROS_WARN_STREAM("Failed to pin thread of " << name_ << " to CPU " << cpu << " (error " << error << ")");
+}
+
+void StageWorker::workerLoop()
+{
+  while (true)
+  {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+      // Queued tasks are finished before stop
+      if (tasks_.empty())
+        return;
+
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    task();
+  }
+}
+
+} // namespace scene_flow_constructor
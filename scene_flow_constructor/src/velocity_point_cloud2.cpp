@@ -0,0 +1,60 @@
+#include "velocity_point_cloud2.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace scene_flow_constructor {
+
+VelocityPointCloud2::VelocityPointCloud2(sensor_msgs::PointCloud2 &msg, int width, int height) : width_(width)
+{
+  static_assert(sizeof(pcl::PointXYZVelocity) == 32, "Layout must match pcl::toROSMsg()");
+
+  msg.height = height;
+  msg.width = width;
+  msg.fields = fields();
+  msg.is_bigendian = false;
+  msg.point_step = sizeof(pcl::PointXYZVelocity);
+  msg.row_step = msg.point_step * width;
+  msg.is_dense = false;
+  msg.data.resize(msg.row_step * height);
+  data_ = msg.data.data();
+
+  pcl::PointXYZVelocity default_value;
+  default_value.x = std::nanf("");
+  default_value.y = std::nanf("");
+  default_value.z = std::nanf("");
+  default_value.data[3] = 1.0f;
+  default_value.vx = std::nanf("");
+  default_value.vy = std::nanf("");
+  default_value.vz = std::nanf("");
+  default_value.data_velocity[3] = 0.0f;
+  for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+    std::memcpy(data_ + i * sizeof(default_value), &default_value, sizeof(default_value));
+}
+
+const std::vector<sensor_msgs::PointField>& VelocityPointCloud2::fields()
+{
+  static const std::vector<sensor_msgs::PointField> velocity_fields = []
+  {
+    // Same order and offsets as POINT_CLOUD_REGISTER_POINT_STRUCT of pcl::PointXYZVelocity
+    std::vector<sensor_msgs::PointField> fields(6);
+    const char* names[] = {"x", "y", "z", "vx", "vy", "vz"};
+    const uint32_t offsets[] = {
+      offsetof(pcl::PointXYZVelocity, x), offsetof(pcl::PointXYZVelocity, y), offsetof(pcl::PointXYZVelocity, z),
+      offsetof(pcl::PointXYZVelocity, vx), offsetof(pcl::PointXYZVelocity, vy), offsetof(pcl::PointXYZVelocity, vz)
+    };
+    for (size_t i = 0; i < fields.size(); i++)
+    {
+      fields[i].name = names[i];
+      fields[i].offset = offsets[i];
+      fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+      fields[i].count = 1;
+    }
+    return fields;
+  }();
+  return velocity_fields;
+}
+
+} // namespace scene_flow_constructor
@@ -0,0 +1,112 @@
+#include "projection_kernel.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+// projectStaticFlow() in single precision is compared with image_geometry in double precision,
+// as calculateStaticOpticalFlow() projected points before vectorization.
+//
+// Counts which aren't multiple of 8 leave tails of rows to scalar code after SIMD blocks.
+
+namespace
+{
+
+/**
+ * \brief Maximum difference of flow[pixel] accepted between both implementations
+ */
+const double TOLERANCE = 1e-3;
+
+image_geometry::PinholeCameraModel makeCameraModel(int width, int height, double tx)
+{
+  // Principal point off the center of pixels
+  sensor_msgs::CameraInfo camera_info;
+  camera_info.width = width;
+  camera_info.height = height;
+  camera_info.K = {700.0, 0.0, width / 2.0 + 0.5, 0.0, 700.0, height / 2.0 - 0.5, 0.0, 0.0, 1.0};
+  camera_info.R = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  camera_info.P = {700.0, 0.0, width / 2.0 + 0.5, tx, 0.0, 700.0, height / 2.0 - 0.5, 0.0, 0.0, 0.0, 1.0, 0.0};
+
+  image_geometry::PinholeCameraModel camera_model;
+  camera_model.fromCameraInfo(camera_info);
+  return camera_model;
+}
+
+class ProjectionKernelTest : public testing::TestWithParam<int>
+{
+};
+
+TEST_P(ProjectionKernelTest, MatchesProject3dToPixel)
+{
+  const int width = GetParam();
+  const int height = 3;
+  // Points of a row are projected from a column in the middle of the row too
+  const int u_begin = width / 3;
+
+  for (double tx : {0.0, -84.0})
+  {
+    SCOPED_TRACE("tx = " + std::to_string(tx));
+    image_geometry::PinholeCameraModel camera_model = makeCameraModel(width, height, tx);
+    scene_flow_constructor::ProjectionParams params(camera_model);
+
+    // Points near the pixels like transformed previous points, and about one in four is invalid
+    std::mt19937 random_engine(width);
+    std::uniform_real_distribution<float> depth(0.5f, 40.0f);
+    std::uniform_real_distribution<float> motion(-0.1f, 0.1f);
+    std::uniform_int_distribution<int> percentage(0, 99);
+
+    for (int v = 0; v < height; v++)
+    {
+      int count = width - u_begin;
+      std::vector<float> points(4 * count);
+      for (int i = 0; i < count; i++)
+      {
+        float* point = &points[4 * i];
+        point[3] = 1.0f;
+        if (percentage(random_engine) < 25)
+        {
+          point[0] = point[1] = point[2] = std::nanf("");
+          continue;
+        }
+        cv::Point3d ray = camera_model.projectPixelTo3dRay(cv::Point2d(u_begin + i, v));
+        float z = depth(random_engine);
+        point[0] = ray.x * z + motion(random_engine);
+        point[1] = ray.y * z + motion(random_engine);
+        point[2] = z + motion(random_engine);
+      }
+
+      std::vector<float> flow(2 * count);
+      scene_flow_constructor::projectStaticFlow(points.data(), count, u_begin, v, params, flow.data());
+
+      for (int i = 0; i < count; i++)
+      {
+        SCOPED_TRACE("u = " + std::to_string(u_begin + i) + ", v = " + std::to_string(v));
+        const float* point = &points[4 * i];
+        if (std::isnan(point[0]))
+        {
+          // NaN points give NaN flow
+          EXPECT_TRUE(std::isnan(flow[2 * i]));
+          EXPECT_TRUE(std::isnan(flow[2 * i + 1]));
+          continue;
+        }
+
+        cv::Point2d pixel = camera_model.project3dToPixel(cv::Point3d(point[0], point[1], point[2]));
+        EXPECT_NEAR(pixel.x - (u_begin + i), flow[2 * i], TOLERANCE);
+        EXPECT_NEAR(pixel.y - v, flow[2 * i + 1], TOLERANCE);
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(Widths, ProjectionKernelTest, testing::Values(1, 3, 4, 7, 8, 13, 37, 64, 101, 640));
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}